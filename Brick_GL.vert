@@ -0,0 +1,28 @@
+#version 330 core
+
+// input data : shared brick quad
+layout (location = 0) in vec2 vertexPosition;
+
+// input data : one set per brick instance
+layout (location = 2) in vec2 brickOffset;
+layout (location = 3) in vec4 brickColor;
+layout (location = 4) in float brickFallPhase;
+
+// Camera block, same layout as in Sample_GL.vert
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+void main ()
+{
+    // Bricks fall as y = -phase^2 from their starting corner
+    vec2 position = vertexPosition + brickOffset - vec2(0, brickFallPhase * brickFallPhase);
+
+    fragColor = brickColor.rgb;
+
+    // Output position of the vertex, in clip space : VP * position
+    gl_Position = VP * vec4(position, 0, 1);
+}
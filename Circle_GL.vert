@@ -0,0 +1,35 @@
+#version 330 core
+
+// input data : one set per circle instance, no per-vertex buffers
+layout (location = 2) in vec2 circleCentre;
+layout (location = 3) in float circleRadius;
+layout (location = 4) in vec4 circleColor;
+
+// Camera block, same layout as in Sample_GL.vert
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+uniform int Sides;
+
+// output data : used by fragment shader
+out vec3 fragColor;
+
+const float TWICE_PI = 6.28318530718;
+
+void main ()
+{
+    // Every 3 vertices make one wedge: the centre and two rim points
+    int side = gl_VertexID / 3;
+    int corner = gl_VertexID % 3;
+
+    vec2 position = circleCentre;
+    if (corner != 0) {
+        float angle = TWICE_PI * float(side + corner - 1) / float(Sides);
+        position += circleRadius * vec2(cos(angle), sin(angle));
+    }
+
+    fragColor = circleColor.rgb;
+
+    // Output position of the vertex, in clip space : VP * position
+    gl_Position = VP * vec4(position, 0, 1);
+}
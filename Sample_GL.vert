@@ -4,7 +4,12 @@
 layout (location = 0) in vec3 vertexPosition;
 layout (location = 1) in vec3 vertexColor;
 
-uniform mat4 MVP;
+// View-projection shared by every program, see CameraBuffer
+layout (std140) uniform Camera {
+    mat4 VP;
+};
+
+uniform mat4 Model;
 
 // output data : used by fragment shader
 out vec3 fragColor;
@@ -17,6 +22,6 @@ void main ()
     // to produce the color of each fragment
     fragColor = vertexColor;
 
-    // Output position of the vertex, in clip space : MVP * position
-    gl_Position = MVP * v;
+    // Output position of the vertex, in clip space : VP * Model * position
+    gl_Position = VP * (Model * v);
 }
@@ -2,7 +2,23 @@
 #include <cmath>
 #include <stdio.h>
 #include <fstream>
+#include <string>
 #include <vector>
+#include <cstddef>
+#include <cstring>
+#include <algorithm>
+#include <chrono>
+#if defined(__SSE2__) || defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#include "world.h"
+#include "outcomes.h"
+#include "rollout.h"
+#include "solver.h"
+#include "brickstep.h"
+#include "envbatch.h"
+#include "spatial.h"
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -24,6 +40,7 @@ struct VAO {
     GLenum PrimitiveMode;
     GLenum FillMode;
     int NumVertices;
+    int NumBytes;
     float CX;
     float CY;
     float r;
@@ -34,11 +51,209 @@ struct GLMatrices {
 	glm::mat4 projection;
 	glm::mat4 model;
 	glm::mat4 view;
-	GLuint MatrixID;
+	GLuint MatrixID; // "Model" uniform of the main program
 } Matrices;
 
 GLuint programID;
 
+/* GL state last set through the helpers below, so calls that would not
+   change anything can be skipped. All program, fill mode, VAO and model
+   matrix changes must go through them or the cache goes stale. */
+struct GLStateCache {
+    GLuint ProgramID;
+    GLenum FillMode;
+    GLuint VertexArrayID;
+    glm::mat4 Model;    // last value uploaded to Matrices.MatrixID
+    bool HasModel;
+    int Issued;         // state calls sent to GL this frame
+    int Elided;         // state calls skipped this frame
+    int LastIssued, LastElided;
+} GLState;
+
+void useProgram (GLuint id)
+{
+    if (GLState.ProgramID == id) { GLState.Elided++; return; }
+    glUseProgram(id);
+    GLState.ProgramID = id;
+    GLState.Issued++;
+}
+
+void setFillMode (GLenum mode)
+{
+    if (GLState.FillMode == mode) { GLState.Elided++; return; }
+    glPolygonMode(GL_FRONT_AND_BACK, mode);
+    GLState.FillMode = mode;
+    GLState.Issued++;
+}
+
+void bindVertexArray (GLuint id)
+{
+    if (GLState.VertexArrayID == id) { GLState.Elided++; return; }
+    glBindVertexArray(id);
+    GLState.VertexArrayID = id;
+    GLState.Issued++;
+}
+
+/* Upload the model matrix for the main program - it must be the current program */
+void uploadModel (const glm::mat4& model)
+{
+    if (GLState.HasModel && memcmp(&GLState.Model, &model, sizeof(model)) == 0) { GLState.Elided++; return; }
+    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &model[0][0]);
+    GLState.Model = model;
+    GLState.HasModel = true;
+    GLState.Issued++;
+}
+
+/* Close the frame's issued/elided counters */
+void endStateFrame ()
+{
+    GLState.LastIssued = GLState.Issued;
+    GLState.LastElided = GLState.Elided;
+    GLState.Issued = 0;
+    GLState.Elided = 0;
+}
+
+/* Recycles VAO and VBO names between meshes and tracks what is alive */
+struct GLNamePool {
+    vector<GLuint> FreeVertexArrays;
+    vector<GLuint> FreeBuffers;
+    int LiveVertexArrays, PeakVertexArrays;
+    int LiveBuffers, PeakBuffers;
+    long LiveBytes, PeakBytes;
+} GLPool;
+
+// Names kept around for reuse; anything beyond this is deleted right away
+const size_t GL_POOL_MAX_FREE = 64;
+
+GLuint acquireVertexArray ()
+{
+    GLuint id;
+    if (GLPool.FreeVertexArrays.empty())
+        glGenVertexArrays(1, &id);
+    else {
+        id = GLPool.FreeVertexArrays.back();
+        GLPool.FreeVertexArrays.pop_back();
+    }
+    GLPool.LiveVertexArrays++;
+    GLPool.PeakVertexArrays = max(GLPool.PeakVertexArrays, GLPool.LiveVertexArrays);
+    return id;
+}
+
+void releaseVertexArray (GLuint id)
+{
+    GLPool.LiveVertexArrays--;
+    if (GLPool.FreeVertexArrays.size() < GL_POOL_MAX_FREE)
+        GLPool.FreeVertexArrays.push_back(id);
+    else {
+        glDeleteVertexArrays(1, &id);
+        if (GLState.VertexArrayID == id) // deleting the bound VAO resets the binding
+            GLState.VertexArrayID = 0;
+    }
+}
+
+GLuint acquireBuffer ()
+{
+    GLuint id;
+    if (GLPool.FreeBuffers.empty())
+        glGenBuffers(1, &id);
+    else {
+        id = GLPool.FreeBuffers.back();
+        GLPool.FreeBuffers.pop_back();
+    }
+    GLPool.LiveBuffers++;
+    GLPool.PeakBuffers = max(GLPool.PeakBuffers, GLPool.LiveBuffers);
+    return id;
+}
+
+void releaseBuffer (GLuint id)
+{
+    GLPool.LiveBuffers--;
+    if (GLPool.FreeBuffers.size() < GL_POOL_MAX_FREE) {
+        // Drop the storage but keep the name for the next mesh
+        glBindBuffer(GL_ARRAY_BUFFER, id);
+        glBufferData(GL_ARRAY_BUFFER, 0, NULL, GL_STATIC_DRAW);
+        GLPool.FreeBuffers.push_back(id);
+    }
+    else
+        glDeleteBuffers(1, &id);
+}
+
+void trackBytes (long bytes)
+{
+    GLPool.LiveBytes += bytes;
+    GLPool.PeakBytes = max(GLPool.PeakBytes, GLPool.LiveBytes);
+}
+
+/* Delete every pooled name - call while the context is still current */
+void drainGLPool ()
+{
+    if (!GLPool.FreeVertexArrays.empty()) {
+        glDeleteVertexArrays(GLPool.FreeVertexArrays.size(), &GLPool.FreeVertexArrays[0]);
+        GLState.VertexArrayID = 0;
+    }
+    if (!GLPool.FreeBuffers.empty())
+        glDeleteBuffers(GLPool.FreeBuffers.size(), &GLPool.FreeBuffers[0]);
+    GLPool.FreeVertexArrays.clear();
+    GLPool.FreeBuffers.clear();
+}
+
+// Uniform block binding point shared by every program's "Camera" block
+const GLuint CAMERA_BINDING = 0;
+
+/* View-projection matrix in a uniform buffer, uploaded only when marked dirty */
+struct CameraBuffer {
+    GLuint Buffer;
+    bool Dirty;
+    glm::mat4 VP;
+    int Uploads;        // times the block has been rewritten
+} Camera;
+
+void createCameraBuffer ()
+{
+    Camera.Buffer = acquireBuffer();
+    trackBytes(sizeof(glm::mat4));
+    glBindBuffer(GL_UNIFORM_BUFFER, Camera.Buffer);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BINDING, Camera.Buffer);
+    Camera.Dirty = true;
+}
+
+/* Point the program's "Camera" block, if it has one, at the shared buffer */
+void bindCameraBlock (GLuint program)
+{
+    GLuint index = glGetUniformBlockIndex(program, "Camera");
+    if (index != GL_INVALID_INDEX)
+        glUniformBlockBinding(program, index, CAMERA_BINDING);
+}
+
+/* Call after changing the projection or the camera */
+void markCameraDirty ()
+{
+    Camera.Dirty = true;
+}
+
+/* Rebuild and upload VP if anything changed since the last upload */
+void updateCamera ()
+{
+    if (!Camera.Dirty)
+        return;
+    Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
+    Camera.VP = Matrices.projection * Matrices.view;
+    glBindBuffer(GL_UNIFORM_BUFFER, Camera.Buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), &Camera.VP[0][0]);
+    Camera.Dirty = false;
+    Camera.Uploads++;
+}
+
+void releaseCameraBuffer ()
+{
+    if (!Camera.Buffer)
+        return;
+    releaseBuffer(Camera.Buffer);
+    trackBytes(-(long)sizeof(glm::mat4));
+    Camera.Buffer = 0;
+}
+
 /* Function to load Shaders - Use it as it is */
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path) {
 
@@ -121,90 +336,215 @@ static void error_callback(int error, const char* description)
     fprintf(stderr, "Error: %s\n", description);
 }
 
+void releaseMeshes ();
+
 void quit(GLFWwindow *window)
 {
+    releaseMeshes();
     glfwDestroyWindow(window);
     glfwTerminate();
 //    exit(EXIT_SUCCESS);
 }
 
 
-/* Generate VAO, VBOs and return VAO handle */
-struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+/* Vertex layouts accepted by create3DObject. Each layout fills itself from
+   float position/colour data and describes its attributes to the bound VAO. */
+
+// Original layout: float x,y,z and float r,g,b - 24 bytes
+struct VertexXYZRGB {
+    GLfloat x, y, z;
+    GLfloat r, g, b;
+
+    static VertexXYZRGB make (GLfloat x, GLfloat y, GLfloat z, GLfloat r, GLfloat g, GLfloat b)
+    {
+        VertexXYZRGB v = { x, y, z, r, g, b };
+        return v;
+    }
+    static void describe ()
+    {
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(VertexXYZRGB), (void*)offsetof(VertexXYZRGB, x));
+        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(VertexXYZRGB), (void*)offsetof(VertexXYZRGB, r));
+    }
+};
+
+// Compact layout: float x,y (z is always 0 here) and normalized RGBA8 - 12 bytes
+struct VertexXYRGBA8 {
+    GLfloat x, y;
+    GLubyte r, g, b, a;
+
+    static GLubyte unorm8 (GLfloat c)
+    {
+        return (GLubyte)(min(max(c, 0.0f), 1.0f) * 255.0f + 0.5f);
+    }
+    static VertexXYRGBA8 make (GLfloat x, GLfloat y, GLfloat r, GLfloat g, GLfloat b)
+    {
+        VertexXYRGBA8 v = { x, y, unorm8(r), unorm8(g), unorm8(b), 255 };
+        return v;
+    }
+    static void describe ()
+    {
+        glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(VertexXYRGBA8), (void*)offsetof(VertexXYRGBA8, x));
+        glVertexAttribPointer(1, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(VertexXYRGBA8), (void*)offsetof(VertexXYRGBA8, r));
+    }
+};
+static_assert(sizeof(VertexXYRGBA8) == 12, "compact vertex must stay at 12 bytes");
+
+// Layout used for all scene geometry - build with -DLEGACY_VERTEX_FORMAT for the 24 byte one
+#ifdef LEGACY_VERTEX_FORMAT
+typedef VertexXYZRGB SceneVertex;
+inline SceneVertex sceneVertex (GLfloat x, GLfloat y, GLfloat z, GLfloat r, GLfloat g, GLfloat b)
+{
+    return VertexXYZRGB::make(x, y, z, r, g, b);
+}
+#else
+typedef VertexXYRGBA8 SceneVertex;
+// The scene is flat, so z goes
+inline SceneVertex sceneVertex (GLfloat x, GLfloat y, GLfloat, GLfloat r, GLfloat g, GLfloat b)
+{
+    return VertexXYRGBA8::make(x, y, r, g, b);
+}
+#endif
+
+/* Generate VAO and one interleaved VBO and return VAO handle */
+template <typename Vertex>
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const Vertex* vertex_data, GLenum fill_mode=GL_FILL)
 {
     struct VAO* vao = new struct VAO;
     vao->PrimitiveMode = primitive_mode;
     vao->NumVertices = numVertices;
+    vao->NumBytes = numVertices*sizeof(Vertex);
     vao->FillMode = fill_mode;
 
     // Create Vertex Array Object
     // Should be done after CreateWindow and before any other GL calls
-    glGenVertexArrays(1, &(vao->VertexArrayID)); // VAO
-    glGenBuffers (1, &(vao->VertexBuffer)); // VBO - vertices
-    glGenBuffers (1, &(vao->ColorBuffer));  // VBO - colors
-
-    glBindVertexArray (vao->VertexArrayID); // Bind the VAO 
-    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO vertices 
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), vertex_buffer_data, GL_STATIC_DRAW); // Copy the vertices into VBO
-    glVertexAttribPointer(
-                          0,                  // attribute 0. Vertices
-                          3,                  // size (x,y,z)
-                          GL_FLOAT,           // type
-                          GL_FALSE,           // normalized?
-                          0,                  // stride
-                          (void*)0            // array buffer offset
-                          );
-
-    glBindBuffer (GL_ARRAY_BUFFER, vao->ColorBuffer); // Bind the VBO colors 
-    glBufferData (GL_ARRAY_BUFFER, 3*numVertices*sizeof(GLfloat), color_buffer_data, GL_STATIC_DRAW);  // Copy the vertex colors
-    glVertexAttribPointer(
-                          1,                  // attribute 1. Color
-                          3,                  // size (r,g,b)
-                          GL_FLOAT,           // type
-                          GL_FALSE,           // normalized?
-                          0,                  // stride
-                          (void*)0            // array buffer offset
-                          );
+    vao->VertexArrayID = acquireVertexArray(); // VAO
+    vao->VertexBuffer = acquireBuffer(); // VBO - interleaved vertices and colors
+    vao->ColorBuffer = 0;
+    trackBytes(vao->NumBytes);
+
+    bindVertexArray (vao->VertexArrayID); // Bind the VAO
+    glBindBuffer (GL_ARRAY_BUFFER, vao->VertexBuffer); // Bind the VBO
+    glBufferData (GL_ARRAY_BUFFER, vao->NumBytes, vertex_data, GL_STATIC_DRAW); // Copy the vertices into VBO
+    Vertex::describe(); // attribute 0 - position, attribute 1 - color
+
+    // Enabled attributes are VAO state, so this is done once here rather than per draw
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
 
     return vao;
 }
 
+/* Generate VAO, VBOs and return VAO handle */
+struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat* color_buffer_data, GLenum fill_mode=GL_FILL)
+{
+    vector<SceneVertex> vertex_data (numVertices);
+    for (int i=0; i<numVertices; i++) {
+        const GLfloat* v = &vertex_buffer_data [3*i];
+        const GLfloat* c = &color_buffer_data [3*i];
+        vertex_data [i] = sceneVertex(v[0], v[1], v[2], c[0], c[1], c[2]);
+    }
+
+    return create3DObject(primitive_mode, numVertices, &vertex_data[0], fill_mode);
+}
+
 /* Generate VAO, VBOs and return VAO handle - Common Color for all vertices */
 struct VAO* create3DObject (GLenum primitive_mode, int numVertices, const GLfloat* vertex_buffer_data, const GLfloat red, const GLfloat green, const GLfloat blue, GLenum fill_mode=GL_FILL)
 {
-    GLfloat* color_buffer_data = new GLfloat [3*numVertices];
+    vector<GLfloat> color_buffer_data (3*numVertices);
     for (int i=0; i<numVertices; i++) {
         color_buffer_data [3*i] = red;
         color_buffer_data [3*i + 1] = green;
         color_buffer_data [3*i + 2] = blue;
     }
 
-    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, color_buffer_data, fill_mode);
+    return create3DObject(primitive_mode, numVertices, vertex_buffer_data, &color_buffer_data[0], fill_mode);
+}
+
+/* Give the VAO's names back to the pool and free the handle */
+void destroy3DObject (struct VAO* vao)
+{
+    releaseVertexArray(vao->VertexArrayID);
+    releaseBuffer(vao->VertexBuffer);
+    if (vao->ColorBuffer)
+        releaseBuffer(vao->ColorBuffer);
+    trackBytes(-vao->NumBytes);
+    delete vao;
 }
 
+/* Owning handle for a VAO - destroys it when reset, reassigned or destroyed */
+class MeshHandle {
+public:
+    MeshHandle (VAO* vao = NULL) : vao(vao) {}
+    ~MeshHandle () { reset(); }
+    MeshHandle (MeshHandle&& other) : vao(other.vao) { other.vao = NULL; }
+    MeshHandle& operator= (MeshHandle&& other) { if (this != &other) { reset(other.vao); other.vao = NULL; } return *this; }
+    MeshHandle& operator= (VAO* other) { reset(other); return *this; }
+
+    void reset (VAO* other = NULL) { if (vao && vao != other) destroy3DObject(vao); vao = other; }
+    VAO* get () const { return vao; }
+    VAO* operator-> () const { return vao; }
+    operator VAO* () const { return vao; }
+
+    MeshHandle (const MeshHandle&) = delete;
+    MeshHandle& operator= (const MeshHandle&) = delete;
+
+private:
+    VAO* vao;
+};
+
 /* Render the VBOs handled by VAO */
 void draw3DObject (struct VAO* vao)
 {
     // Change the Fill Mode for this object
-    glPolygonMode (GL_FRONT_AND_BACK, vao->FillMode);
-
-    // Bind the VAO to use
-    glBindVertexArray (vao->VertexArrayID);
-
-    // Enable Vertex Attribute 0 - 3d Vertices
-    glEnableVertexAttribArray(0);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->VertexBuffer);
+    setFillMode (vao->FillMode);
 
-    // Enable Vertex Attribute 1 - Color
-    glEnableVertexAttribArray(1);
-    // Bind the VBO to use
-    glBindBuffer(GL_ARRAY_BUFFER, vao->ColorBuffer);
+    // Bind the VAO to use - it already holds the VBO and enabled attributes
+    bindVertexArray (vao->VertexArrayID);
 
     // Draw the geometry !
     glDrawArrays(vao->PrimitiveMode, 0, vao->NumVertices); // Starting from vertex 0; 3 vertices total -> 1 triangle
 }
 
+/* A draw3DObject call deferred until flushRenderQueue */
+struct DrawItem {
+    GLuint ProgramID;
+    VAO* Mesh;
+    glm::mat4 Model;
+};
+
+vector<DrawItem> renderQueue;
+
+/* Queue the VAO to be drawn with the model matrix using the main program */
+void submit3DObject (struct VAO* vao, const glm::mat4& model)
+{
+    DrawItem item = { programID, vao, model };
+    renderQueue.push_back(item);
+}
+
+// Sort by program, then fill mode, then mesh so equal state ends up adjacent
+bool drawItemLess (const DrawItem& a, const DrawItem& b)
+{
+    if (a.ProgramID != b.ProgramID)
+        return a.ProgramID < b.ProgramID;
+    if (a.Mesh->FillMode != b.Mesh->FillMode)
+        return a.Mesh->FillMode < b.Mesh->FillMode;
+    return a.Mesh->VertexArrayID < b.Mesh->VertexArrayID;
+}
+
+/* Draw everything queued since the last flush in state order */
+void flushRenderQueue ()
+{
+    stable_sort(renderQueue.begin(), renderQueue.end(), drawItemLess);
+    for (size_t i = 0; i < renderQueue.size(); i++)
+    {
+        DrawItem& item = renderQueue[i];
+        useProgram(item.ProgramID);
+        uploadModel(item.Model);
+        draw3DObject(item.Mesh);
+    }
+    renderQueue.clear();
+}
+
 /**************************
  * Customizable functions *
  **************************/
@@ -213,17 +553,103 @@ float triangle_rot_dir = 1;
 float rectangle_rot_dir = 1;
 bool triangle_rot_status = true;
 bool rectangle_rot_status = true;
-float x = -20.0 ; float y = -84.0; float z = 0.0;
-float X = 20.0 ; float Y = -84.0; float Z = 0.0;
-float move_unit = 1.5f;
-float rot_ang = 0;
-double p = 0, q = 0, t=0, u=15, tim =0, tim2=0, tim3=0;
+World world;
+
+/* Frames are drawn between the world a tick ago and the world now. Of the
+   one a tick ago only what moves is kept - baskets, cannon, shots in flight
+   and the bricks' falls - so keeping it each tick copies little. */
+struct RenderState {
+  float x, y, X, Y, rot_ang;
+  vector<int> ShotHandle;       // per shot in flight, in Active's order
+  vector<long> ShotLaunched;
+  vector<float> ShotX, ShotY;
+  vector<int> ShotSlot;         // handle -> index above, while ShotHandle agrees
+  vector<int> BrickId;          // per row of the brick table
+  vector<double> BrickPhase;
+
+  void capture (const World& w)
+  {
+    x = w.x; y = w.y;
+    X = w.X; Y = w.Y;
+    rot_ang = w.rot_ang;
+    size_t n = w.Shots.size();
+    ShotHandle.resize(n);
+    ShotLaunched.resize(n);
+    ShotX.resize(n);
+    ShotY.resize(n);
+    if (ShotSlot.size() < w.Shots.capacity())
+      ShotSlot.resize(w.Shots.capacity(), -1);
+    for (size_t k = 0; k < n; k++) {
+      const Shot& shot = w.Shots.Active[k];
+      ShotHandle[k] = shot.Handle;
+      ShotLaunched[k] = shot.Launched;
+      ShotX[k] = shot.x();
+      ShotY[k] = shot.y();
+      ShotSlot[shot.Handle] = (int)k;
+    }
+    BrickId = w.Bricks.Id;
+    BrickPhase = w.Bricks.Phase;
+  }
+
+  // Where the shot with handle, fired on tick launched, was; false if it
+  // wasn't in flight then
+  bool shot (int handle, long launched, float& sx, float& sy) const
+  {
+    if (handle < 0 || (size_t)handle >= ShotSlot.size())
+      return false;
+    int k = ShotSlot[handle];
+    if (k < 0 || (size_t)k >= ShotHandle.size() || ShotHandle[k] != handle || ShotLaunched[k] != launched)
+      return false;
+    sx = ShotX[k];
+    sy = ShotY[k];
+    return true;
+  }
+};
+
+RenderState previousState;    // the world a tick ago, as drawing needs it
+double tickRate = WORLD_REFERENCE_HZ; // simulation steps per second, --tick-rate
 double key_press_time = 0;double key_release_time = 0 , u_f;
-int flag = 0, flag1 = 0, flag2 = 0;
-int Obs1_o = 0 ;
-int Obs2_o = 0 ;
-int Obs3_o = 0 ;
-int score = 0;
+bool useBatch = true; // false draws every shape on its own through draw3DObject
+int sweepThreads = 0; // --threads for --sweep, --solve and the frame's jobs, 0 is one per hardware thread
+
+// --deterministic: the fire key's charge is counted in ticks rather than
+// read off the clock, and every input is logged with the tick it landed
+// on, so --replay can run the game again to the same bits
+bool deterministic = false;
+long key_press_tick = 0;
+
+// Aim assist: while the fire key is held, the brick a shot fired now would
+// hit, looked up in the table --build-outcomes writes
+OutcomeTable outcomes;
+const char* outcomesPath = "outcomes.bin";  // --outcomes
+bool charging = false;
+
+// A charge in whole ticks, as every shot is fired with, table or not; the
+// table covers just those, so the marker shows what the shot does
+double tickCharge (double held)
+{
+  return lround(held * tickRate) / tickRate;
+}
+
+// Seconds the fire key has been held, counted as FIRE will count it
+double heldCharge ()
+{
+  double held = deterministic ? (world.Ticks - key_press_tick) / tickRate : glfwGetTime() - key_press_time;
+  return tickCharge(held);
+}
+
+void applyInput (const WorldInput& input)
+{
+  if (deterministic)
+    printf("input %ld %d %a\n", world.Ticks, (int)input.Action, input.Charge);
+  world.apply(input);
+}
+
+void reportRun ()
+{
+  if (deterministic)
+    printf("end %ld %016llx\n", world.Ticks, (unsigned long long)world.hash());
+}
 
 /* Executed when a regular key is pressed/released/held-down */
 /* Prefered for Keyboard events */
@@ -240,12 +666,18 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
             case GLFW_KEY_P:
                 triangle_rot_status = !triangle_rot_status;
                 break;
+            case GLFW_KEY_B:
+                useBatch = !useBatch;
+                break;
             case GLFW_KEY_SPACE:
+            {
                 key_release_time = glfwGetTime();
-                u_f = key_release_time - key_press_time;
-                u = u*u_f*2.5;
-                flag=1;
+                u_f = heldCharge();
+                charging = false;
+                WorldInput fire = { FIRE, u_f };
+                applyInput(fire);
                 break;
+            }
             default:
                 break;
         }
@@ -256,17 +688,16 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
                 quit(window);
                 break;
 
+            case GLFW_KEY_SPACE:
+                key_press_time = glfwGetTime();
+                key_press_tick = world.Ticks;
+                charging = true;
+                break;
             case GLFW_KEY_W:
-                if( rot_ang >= 50 )
-                    rot_ang = 50 ;
-                else
-                    rot_ang += 5;
+                applyInput(WorldInput { AIM_UP, 0 });
                 break;
             case GLFW_KEY_S:
-                if ( rot_ang <= -50)
-                    rot_ang = -50;
-                else
-                    rot_ang -= 5;
+                applyInput(WorldInput { AIM_DOWN, 0 });
                 break;   
             default:
                 break;
@@ -276,11 +707,11 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 
             case GLFW_KEY_RIGHT:
               if(state1==GLFW_PRESS)
-                X += move_unit;
+                applyInput(WorldInput { BASKET2_RIGHT, 0 });
               break;
             case GLFW_KEY_LEFT:
               if(state1==GLFW_PRESS)
-                X -= move_unit;
+                applyInput(WorldInput { BASKET2_LEFT, 0 });
               break;
             default:
               break;
@@ -291,11 +722,11 @@ void keyboard (GLFWwindow* window, int key, int scancode, int action, int mods)
 
       case GLFW_KEY_RIGHT:
         if(state2==GLFW_PRESS)
-          x += move_unit;
+          applyInput(WorldInput { BASKET1_RIGHT, 0 });
         break;
       case GLFW_KEY_LEFT:
         if(state2==GLFW_PRESS)
-          x -= move_unit;
+          applyInput(WorldInput { BASKET1_LEFT, 0 });
         break;
       default:
         break; 
@@ -338,6 +769,9 @@ void mouseButton (GLFWwindow* window, int button, int action, int mods)
 }
 
 
+// Framebuffer size in pixels, kept up to date by reshapeWindow
+int framebufferWidth = 600, framebufferHeight = 600;
+
 /* Executed when window is resized to 'width' and 'height' */
 /* Modify the bounds of the screen here in glm::ortho or Field of View in glm::Perspective */
 void reshapeWindow (GLFWwindow* window, int width, int height)
@@ -351,11 +785,14 @@ void reshapeWindow (GLFWwindow* window, int width, int height)
 
 	// sets the viewport of openGL renderer
 	glViewport (0, 0, (GLsizei) fbwidth, (GLsizei) fbheight);
+	framebufferWidth = fbwidth;
+	framebufferHeight = fbheight;
 
     Matrices.projection = glm::ortho(-100.0f, 100.0f, -100.0f, 100.0f, -100.0f, 100.0f);
+    markCameraDirty();
 }
 
-VAO *triangle, *rectangle, *rectangle1, *rectangle2, *rectangle3, *rectangle4, *circle1, *circle2, *circle3, *Obs1, *Obs2, *Obs3, *obj[20], *line;
+MeshHandle triangle, rectangle, line;
 
 // Creates the triangle object used in this sample code
 void createTriangle ()
@@ -381,18 +818,19 @@ void createTriangle ()
 }
 
 // Creates the rectangle object used in this sample code
+// GL3 accepts only Triangles. Quads are not supported
+static const GLfloat cannon_vertex_data [] = {
+  -99,0,0, // vertex 1
+  -69,0,0, // vertex 2
+  -69, 5,0, // vertex 3
+
+  -69,5,0, // vertex 3
+  -99, 5, 0, // vertex 4
+  -99,0,0  // vertex 1
+};
+
 void createRectangle ()
 {
-  // GL3 accepts only Triangles. Quads are not supported
-  static const GLfloat vertex_buffer_data [] = {
-    -99,0,0, // vertex 1
-    -69,0,0, // vertex 2
-    -69, 5,0, // vertex 3
-
-    -69,5,0, // vertex 3
-    -99, 5, 0, // vertex 4
-    -99,0,0  // vertex 1
-  };
 
   static const GLfloat color_buffer_data [] = {
     1,0,0, // color 1
@@ -405,98 +843,184 @@ void createRectangle ()
   };
 
   // create3DObject creates and returns a handle to a VAO that can be used later
-  rectangle = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, 0,0,0);
+  rectangle = create3DObject(GL_TRIANGLES, 6, cannon_vertex_data, 0,0,0);
 }
 
 
+// A unit segment along x; mirrorModel() places it over each mirror
+static const GLfloat mirror_vertex_data [] = {
+  0, 0, 0, //vertex1
+  1, 0, 0, //vertex2
+  0, 0, 0, //vertex3
+};
+
 void drawline ()
 {
-  static const GLfloat vertex_buffer_data [] = {
-    72, -2, 0, //vertex1
-    82, 22, 0, //vertex2
-    72, -2, 0, //vertex3
-};
 
   static const GLfloat color_buffer_data [] = {
     1,0,0, // color 1
     0,0,1, // color 2
+    1,0,0, // color 3
 };
 
-  line = create3DObject(GL_TRIANGLES, 3, vertex_buffer_data, color_buffer_data, GL_LINE);
+  line = create3DObject(GL_TRIANGLES, 3, mirror_vertex_data, color_buffer_data, GL_LINE);
 
 }
 
-void drawCircle1(GLfloat radius, GLint numberOfSides)
-{
-  int numberOfVertices = numberOfSides + 2;
-
-  GLfloat twicePi = 2.0f * M_PI;
-
-  GLfloat circleVerticesX[numberOfVertices];
-  GLfloat circleVerticesY[numberOfVertices];
-  GLfloat circleVerticesZ[numberOfVertices];
+/* cos and sin of 2*pi*k/numberOfSides for k = 0..numberOfSides, as separate
+   arrays padded to a multiple of 8 so vector loads never run off the end */
+struct CircleTable {
+    vector<GLfloat> Cos;
+    vector<GLfloat> Sin;
+};
 
-  circleVerticesX[0] = x;
-  circleVerticesY[0] = y;
-  circleVerticesZ[0] = z;
+const CircleTable& circleTable (GLint numberOfSides)
+{
+  static vector<CircleTable> tables;
+  if ((int)tables.size() <= numberOfSides)
+    tables.resize(numberOfSides + 1);
 
-  for ( int i = 1; i < numberOfVertices; i++ )
+  CircleTable& table = tables[numberOfSides];
+  if (table.Cos.empty())
   {
-    circleVerticesX[i] = x + ( radius * cos( i *  twicePi / numberOfSides ) );
-    circleVerticesY[i] = y + ( radius * sin( i * twicePi / numberOfSides ) );
-    circleVerticesZ[i] = z;
+    GLfloat twicePi = 2.0f * M_PI;
+    int padded = (numberOfSides + 1 + 7) & ~7;
+    table.Cos.resize(padded, 1.0f);
+    table.Sin.resize(padded, 0.0f);
+    for ( int i = 0; i <= numberOfSides; i++ )
+    {
+      table.Cos[i] = cos( i * twicePi / numberOfSides );
+      table.Sin[i] = sin( i * twicePi / numberOfSides );
+    }
   }
+  return table;
+}
 
-  GLfloat allCircleVertices[( numberOfVertices ) * 3];
+/* Circle tessellation kernels. Each writes count rim vertices
+   (cx + r*cos, cy + r*sin) with a fixed colour straight into out. */
+enum CircleKernel { CIRCLE_KERNEL_SCALAR, CIRCLE_KERNEL_SSE2, CIRCLE_KERNEL_AVX2 };
+const char* const CIRCLE_KERNEL_NAMES[] = { "scalar", "sse2", "avx2" };
 
-  for ( int i = 0; i < numberOfVertices; i++ )
+void circleRimScalar (GLfloat cx, GLfloat cy, GLfloat radius, const GLfloat* cosTable, const GLfloat* sinTable, int count, const VertexXYRGBA8& colour, VertexXYRGBA8* out)
+{
+  for (int i = 0; i < count; i++)
   {
-    allCircleVertices[i * 3] = circleVerticesX[i];
-    allCircleVertices[( i * 3 ) + 1] = circleVerticesY[i];
-    allCircleVertices[( i * 3 ) + 2] = circleVerticesZ[i];
+    VertexXYRGBA8 v = colour;
+    v.x = cx + radius * cosTable[i];
+    v.y = cy + radius * sinTable[i];
+    out[i] = v;
   }
-
-  circle1 = create3DObject(GL_TRIANGLE_FAN, numberOfVertices, allCircleVertices,1,1,1);
-
 }
 
-
-void drawCircle2(GLfloat radius, GLint numberOfSides )
+#if defined(__SSE2__)
+/* Interleave 4 x, 4 y and the colour bits into 4 packed 12 byte vertices */
+static inline void storeVertices4 (GLfloat* dst, __m128 xs, __m128 ys, __m128 cs)
 {
-  int numberOfVertices = numberOfSides + 2;
-
-  GLfloat twicePi = 2.0f * M_PI;
-
-  GLfloat circleVerticesX[numberOfVertices];
-  GLfloat circleVerticesY[numberOfVertices];
-  GLfloat circleVerticesZ[numberOfVertices];
+  __m128 lo = _mm_unpacklo_ps(xs, ys);                                    // x0 y0 x1 y1
+  __m128 hi = _mm_unpackhi_ps(xs, ys);                                    // x2 y2 x3 y3
+  __m128 c_x1 = _mm_shuffle_ps(cs, lo, _MM_SHUFFLE(3, 2, 0, 0));          // c  c  x1 y1
+  __m128 y1_c = _mm_shuffle_ps(lo, cs, _MM_SHUFFLE(0, 0, 3, 3));          // y1 y1 c  c
+  __m128 c_x3 = _mm_shuffle_ps(cs, hi, _MM_SHUFFLE(2, 2, 0, 0));          // c  c  x3 x3
+  __m128 y3_c = _mm_shuffle_ps(hi, cs, _MM_SHUFFLE(0, 0, 3, 3));          // y3 y3 c  c
+  _mm_storeu_ps(dst,     _mm_shuffle_ps(lo, c_x1, _MM_SHUFFLE(2, 1, 1, 0)));   // x0 y0 c  x1
+  _mm_storeu_ps(dst + 4, _mm_shuffle_ps(y1_c, hi, _MM_SHUFFLE(1, 0, 2, 0)));   // y1 c  x2 y2
+  _mm_storeu_ps(dst + 8, _mm_shuffle_ps(c_x3, y3_c, _MM_SHUFFLE(2, 0, 2, 0))); // c  x3 y3 c
+}
 
-  circleVerticesX[0] = X;
-  circleVerticesY[0] = Y;
-  circleVerticesZ[0] = Z;
+void circleRimSSE2 (GLfloat cx, GLfloat cy, GLfloat radius, const GLfloat* cosTable, const GLfloat* sinTable, int count, const VertexXYRGBA8& colour, VertexXYRGBA8* out)
+{
+  GLfloat colourBits;
+  memcpy(&colourBits, &colour.r, sizeof(colourBits));
+  __m128 cs = _mm_set1_ps(colourBits);
+  __m128 vcx = _mm_set1_ps(cx), vcy = _mm_set1_ps(cy), vr = _mm_set1_ps(radius);
 
-  for ( int i = 1; i < numberOfVertices; i++ )
+  int i = 0;
+  for (; i + 4 <= count; i += 4)
   {
-    circleVerticesX[i] = X + ( radius * cos( i *  twicePi / numberOfSides ) );
-    circleVerticesY[i] = Y + ( radius * sin( i * twicePi / numberOfSides ) );
-    circleVerticesZ[i] = Z;
+    __m128 xs = _mm_add_ps(vcx, _mm_mul_ps(vr, _mm_loadu_ps(cosTable + i)));
+    __m128 ys = _mm_add_ps(vcy, _mm_mul_ps(vr, _mm_loadu_ps(sinTable + i)));
+    storeVertices4((GLfloat*)(out + i), xs, ys, cs);
   }
+  circleRimScalar(cx, cy, radius, cosTable + i, sinTable + i, count - i, colour, out + i);
+}
+#endif
 
-  GLfloat allCircleVertices[( numberOfVertices ) * 3];
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_CIRCLE_AVX2 1
+__attribute__((target("avx2,fma")))
+void circleRimAVX2 (GLfloat cx, GLfloat cy, GLfloat radius, const GLfloat* cosTable, const GLfloat* sinTable, int count, const VertexXYRGBA8& colour, VertexXYRGBA8* out)
+{
+  GLfloat colourBits;
+  memcpy(&colourBits, &colour.r, sizeof(colourBits));
+  __m128 cs = _mm_set1_ps(colourBits);
+  __m256 vcx = _mm256_set1_ps(cx), vcy = _mm256_set1_ps(cy), vr = _mm256_set1_ps(radius);
 
-  for ( int i = 0; i < numberOfVertices; i++ )
+  int i = 0;
+  for (; i + 8 <= count; i += 8)
   {
-    allCircleVertices[i * 3] = circleVerticesX[i];
-    allCircleVertices[( i * 3 ) + 1] = circleVerticesY[i];
-    allCircleVertices[( i * 3 ) + 2] = circleVerticesZ[i];
+    __m256 xs = _mm256_fmadd_ps(vr, _mm256_loadu_ps(cosTable + i), vcx);
+    __m256 ys = _mm256_fmadd_ps(vr, _mm256_loadu_ps(sinTable + i), vcy);
+    GLfloat* dst = (GLfloat*)(out + i);
+    storeVertices4(dst, _mm256_castps256_ps128(xs), _mm256_castps256_ps128(ys), cs);
+    storeVertices4(dst + 12, _mm256_extractf128_ps(xs, 1), _mm256_extractf128_ps(ys, 1), cs);
   }
+  // Clear the upper halves before running legacy SSE code, or every SSE op pays a transition
+  _mm256_zeroupper();
+  circleRimSSE2(cx, cy, radius, cosTable + i, sinTable + i, count - i, colour, out + i);
+}
+#endif
 
-  circle2 = create3DObject(GL_TRIANGLE_FAN, numberOfVertices, allCircleVertices,0,0,0);
+/* Fastest kernel this CPU supports, picked once at start-up */
+CircleKernel detectCircleKernel ()
+{
+#if defined(HAVE_CIRCLE_AVX2)
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    return CIRCLE_KERNEL_AVX2;
+#endif
+#if defined(__SSE2__)
+  return CIRCLE_KERNEL_SSE2;
+#else
+  return CIRCLE_KERNEL_SCALAR;
+#endif
+}
 
+CircleKernel circleKernel = detectCircleKernel();
+
+/* Write a circle as a triangle fan - the centre then numberOfSides + 1 rim
+   points - into out, which must hold numberOfSides + 2 vertices */
+void tessellateCircle (GLfloat cx, GLfloat cy, GLfloat radius, GLint numberOfSides, GLfloat red, GLfloat green, GLfloat blue, VertexXYRGBA8* out, CircleKernel kernel = circleKernel)
+{
+  const CircleTable& table = circleTable(numberOfSides);
+  out[0] = VertexXYRGBA8::make(cx, cy, red, green, blue);
+
+  switch (kernel) {
+#if defined(HAVE_CIRCLE_AVX2)
+    case CIRCLE_KERNEL_AVX2:
+      circleRimAVX2(cx, cy, radius, &table.Cos[0], &table.Sin[0], numberOfSides + 1, out[0], out + 1);
+      break;
+#endif
+#if defined(__SSE2__)
+    case CIRCLE_KERNEL_SSE2:
+      circleRimSSE2(cx, cy, radius, &table.Cos[0], &table.Sin[0], numberOfSides + 1, out[0], out + 1);
+      break;
+#endif
+    default:
+      circleRimScalar(cx, cy, radius, &table.Cos[0], &table.Sin[0], numberOfSides + 1, out[0], out + 1);
+      break;
+  }
 }
 
+/* Same fan for the 24 byte layout - table driven, no SIMD */
+void tessellateCircle (GLfloat cx, GLfloat cy, GLfloat radius, GLint numberOfSides, GLfloat red, GLfloat green, GLfloat blue, VertexXYZRGB* out)
+{
+  const CircleTable& table = circleTable(numberOfSides);
+  out[0] = VertexXYZRGB::make(cx, cy, 0, red, green, blue);
+  for (int i = 0; i <= numberOfSides; i++)
+    out[i + 1] = VertexXYZRGB::make(cx + radius * table.Cos[i], cy + radius * table.Sin[i], 0, red, green, blue);
+}
 
-void drawCircle3(GLfloat a, GLfloat b, GLfloat c, GLfloat radius, GLint numberOfSides )
+/* The per-frame circle code this kernel replaced, kept for benchCircles */
+void referenceCircle (GLfloat a, GLfloat b, GLfloat c, GLfloat radius, GLint numberOfSides, GLfloat* allCircleVertices)
 {
   int numberOfVertices = numberOfSides + 2;
 
@@ -517,415 +1041,1555 @@ void drawCircle3(GLfloat a, GLfloat b, GLfloat c, GLfloat radius, GLint numberOf
     circleVerticesZ[i] = c;
   }
 
-  GLfloat allCircleVertices[( numberOfVertices ) * 3];
-
   for ( int i = 0; i < numberOfVertices; i++ )
   {
     allCircleVertices[i * 3] = circleVerticesX[i];
     allCircleVertices[( i * 3 ) + 1] = circleVerticesY[i];
     allCircleVertices[( i * 3 ) + 2] = circleVerticesZ[i];
   }
+}
+
+/* Micro-benchmark: time per circle for the old loop and each kernel */
+void benchCircles ()
+{
+  const GLint sides[] = { 32, 360 };
+  const int iterations = 200000;
 
-  circle3 = create3DObject(GL_TRIANGLE_FAN, numberOfVertices, allCircleVertices,1,1,1);
+  for (int s = 0; s < 2; s++)
+  {
+    int numberOfVertices = sides[s] + 2;
+    vector<GLfloat> reference(3 * numberOfVertices);
+    vector<VertexXYRGBA8> packed(numberOfVertices);
+    double checksum = 0;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+      referenceCircle(i & 63, 0, 0, 12, sides[s], &reference[0]);
+      checksum += reference[3];
+    }
+    double referenceNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / iterations;
+    printf("circle %3d sides  %-9s %9.1f ns/circle\n", sides[s], "reference", referenceNs);
 
+    for (int k = CIRCLE_KERNEL_SCALAR; k <= circleKernel; k++)
+    {
+      start = chrono::steady_clock::now();
+      for (int i = 0; i < iterations; i++) {
+        tessellateCircle(i & 63, 0, 12, sides[s], 1, 1, 1, &packed[0], (CircleKernel)k);
+        checksum += packed[1].x;
+      }
+      double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / iterations;
+      printf("circle %3d sides  %-9s %9.1f ns/circle  %6.1fx\n", sides[s], CIRCLE_KERNEL_NAMES[k], ns, referenceNs / ns);
+    }
+    printf("(checksum %g)\n", checksum);
+  }
 }
 
+/* Unit circle meshes centred at the origin, built once and shared.
+   Placement and radius come from the model matrix at draw time. */
+struct CircleMesh {
+    GLint NumberOfSides;
+    GLfloat Red, Green, Blue;
+    MeshHandle Mesh;
+};
+vector<CircleMesh> circleCache;
 
-void createRectangle1 ()
+VAO* unitCircle(GLint numberOfSides, GLfloat red, GLfloat green, GLfloat blue)
 {
-  // GL3 accepts only Triangles. Quads are not supported
-  static const GLfloat vertex_buffer_data [] = {
-    0,99,0, // vertex 1
-    0,93,0, // vertex 2
-    6, 93,0, // vertex 3
+  for (size_t i = 0; i < circleCache.size(); i++)
+  {
+    CircleMesh& c = circleCache[i];
+    if (c.NumberOfSides == numberOfSides && c.Red == red && c.Green == green && c.Blue == blue)
+      return c.Mesh;
+  }
 
-    6, 93,0, // vertex 3
-    6, 99,0, // vertex 4
-    0,99,0  // vertex 1
-  };
+  int numberOfVertices = numberOfSides + 2;
 
-  static const GLfloat color_buffer_data [] = {
-    1,0,0, // color 1
-    0,0,1, // color 2
-    0,1,0, // color 3
+  vector<SceneVertex> allCircleVertices(numberOfVertices);
+  tessellateCircle(0, 0, 1, numberOfSides, red, green, blue, &allCircleVertices[0]);
 
-    0,1,0, // color 3
-    0.3,0.3,0.3, // color 4
-    1,0,0  // color 1
-  };
+  circleCache.push_back(CircleMesh());
+  CircleMesh& c = circleCache.back();
+  c.NumberOfSides = numberOfSides;
+  c.Red = red; c.Green = green; c.Blue = blue;
+  c.Mesh = create3DObject(GL_TRIANGLE_FAN, numberOfVertices, &allCircleVertices[0]);
+  return c.Mesh;
+}
 
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  rectangle1 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data, 2,2,2, GL_FILL);
+// Largest distance in pixels a circle's polygon may fall inside the true circle
+const GLfloat CIRCLE_MAX_PIXEL_ERROR = 0.5f;
+// Side counts circles are rounded up to, so meshes can be cached per bucket
+const GLint CIRCLE_LOD_SIDES[] = { 8, 16, 32, 64, 128, 256 };
+const int CIRCLE_LOD_COUNT = sizeof(CIRCLE_LOD_SIDES) / sizeof(CIRCLE_LOD_SIDES[0]);
 
-  //Obs1->r = 1;
-  //Obs1->CX = 1;
-  //Obs1->CY = 97;
+/* Pick the side count for a circle of the given world radius from its size
+   on screen. A regular n-gon inside a circle of R pixels is at most
+   R*(1 - cos(pi/n)) pixels off, so n >= pi / acos(1 - error/R). */
+GLint circleSides (GLfloat radius)
+{
+  // Pixels per world unit along each axis of the current projection
+  GLfloat scaleX = fabs(Matrices.projection[0][0]) * framebufferWidth / 2;
+  GLfloat scaleY = fabs(Matrices.projection[1][1]) * framebufferHeight / 2;
+  GLfloat pixels = radius * max(scaleX, scaleY);
+
+  GLfloat sides = 0;
+  if (pixels > CIRCLE_MAX_PIXEL_ERROR)
+    sides = M_PI / acos(1 - CIRCLE_MAX_PIXEL_ERROR / pixels);
+
+  for (int i = 0; i < CIRCLE_LOD_COUNT; i++)
+    if (CIRCLE_LOD_SIDES[i] >= sides)
+      return CIRCLE_LOD_SIDES[i];
+  return CIRCLE_LOD_SIDES[CIRCLE_LOD_COUNT - 1];
+}
 
-  if(Obs1_o == 0 )
+/* Build every LOD bucket up front so resizing never creates meshes mid-frame */
+void createCircles ()
+{
+  for (int i = 0; i < CIRCLE_LOD_COUNT; i++)
   {
-    obj[1] = rectangle1;
-    
+    unitCircle(CIRCLE_LOD_SIDES[i], 1, 1, 1);
+    unitCircle(CIRCLE_LOD_SIDES[i], 0, 0, 0);
   }
 }
 
-void createRectangle2 ()
+/* Model matrix placing a unit circle at (cx,cy,cz) with the given radius */
+glm::mat4 circleModel (GLfloat cx, GLfloat cy, GLfloat cz, GLfloat radius)
 {
-  // GL3 accepts only Triangles. Quads are not supported
-  static const GLfloat vertex_buffer_data [] = {
-    14,95,0, // vertex 1
-    14,89,0, // vertex 2
-    20, 89,0, // vertex 3
+  return glm::translate (glm::vec3(cx, cy, cz)) * glm::scale (glm::vec3(radius, radius, 1));
+}
 
-    20, 89,0, // vertex 3
-    20, 95,0, // vertex 4
-    14,95,0  // vertex 1
-  };
+glm::mat4 mirrorModel (const Mirror& m)
+{
+  return glm::translate (glm::vec3(m.AX, m.AY, 0)) *
+         glm::rotate ((float)atan2(m.DY, m.DX), glm::vec3(0, 0, 1)) *
+         glm::scale (glm::vec3(m.Length, 1, 1));
+}
 
-  static const GLfloat color_buffer_data [] = {
-    1,0,0, // color 1
-    0,0,1, // color 2
-    0,1,0, // color 3
+/* Per-instance data for the brick renderer - 16 bytes */
+struct BrickInstance {
+    GLfloat OffsetX, OffsetY; // lower-left corner before falling
+    GLubyte Color[4];
+    GLfloat FallPhase;        // drawn at OffsetY - FallPhase^2
+};
 
-    0,1,0, // color 3
-    0.3,0.3,0.3, // color 4
-    1,0,0  // color 1
-  };
+/* Draws every brick with one instanced call over a shared quad */
+struct BrickRenderer {
+    GLuint ProgramID;
+    GLuint VertexArrayID;
+    GLuint QuadBuffer;
+    GLuint InstanceBuffer;
+    int Capacity;             // instances the buffer can hold
+    vector<BrickInstance> Instances;
+} Bricks;
 
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  rectangle2 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data,0,0,0, GL_FILL);
+const GLfloat BRICK_SIZE = 6;
 
-  //Obs1->r = 1;
-  //Obs1->CX = 1;
-  //Obs1->CY = 97;
+void createBrickRenderer ()
+{
+  static const GLfloat quad_buffer_data [] = {
+    0, BRICK_SIZE,
+    0, 0,
+    BRICK_SIZE, 0,
+
+    BRICK_SIZE, 0,
+    BRICK_SIZE, BRICK_SIZE,
+    0, BRICK_SIZE
+  };
 
-  if(Obs2_o == 0)
-  {
-    obj[2] = rectangle2;   
+  Bricks.ProgramID = LoadShaders( "Brick_GL.vert", "Sample_GL.frag" );
+  bindCameraBlock(Bricks.ProgramID);
+
+  Bricks.VertexArrayID = acquireVertexArray();
+  Bricks.QuadBuffer = acquireBuffer();
+  Bricks.InstanceBuffer = acquireBuffer();
+  Bricks.Capacity = 0;
+  trackBytes(sizeof(quad_buffer_data));
+
+  bindVertexArray (Bricks.VertexArrayID);
+
+  glBindBuffer (GL_ARRAY_BUFFER, Bricks.QuadBuffer);
+  glBufferData (GL_ARRAY_BUFFER, sizeof(quad_buffer_data), quad_buffer_data, GL_STATIC_DRAW);
+  glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+  glEnableVertexAttribArray(0);
+
+  // Instance attributes advance once per brick
+  glBindBuffer (GL_ARRAY_BUFFER, Bricks.InstanceBuffer);
+  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(BrickInstance), (void*)offsetof(BrickInstance, OffsetX));
+  glVertexAttribPointer(3, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(BrickInstance), (void*)offsetof(BrickInstance, Color));
+  glVertexAttribPointer(4, 1, GL_FLOAT, GL_FALSE, sizeof(BrickInstance), (void*)offsetof(BrickInstance, FallPhase));
+  for (GLuint attrib = 2; attrib <= 4; attrib++) {
+    glEnableVertexAttribArray(attrib);
+    glVertexAttribDivisor(attrib, 1);
   }
 }
 
-void createRectangle3 ()
+/* Queue a brick for this frame's drawBricks call */
+void addBrick (GLfloat offsetX, GLfloat offsetY, GLfloat red, GLfloat green, GLfloat blue, GLfloat fallPhase)
 {
-  // GL3 accepts only Triangles. Quads are not supported
-  static const GLfloat vertex_buffer_data [] = {
-    28,94,0, // vertex 1
-    28,88,0, // vertex 2
-    34, 88,0, // vertex 3
+  BrickInstance b;
+  b.OffsetX = offsetX;
+  b.OffsetY = offsetY;
+  b.Color[0] = VertexXYRGBA8::unorm8(red);
+  b.Color[1] = VertexXYRGBA8::unorm8(green);
+  b.Color[2] = VertexXYRGBA8::unorm8(blue);
+  b.Color[3] = 255;
+  b.FallPhase = fallPhase;
+  Bricks.Instances.push_back(b);
+}
 
-    34, 88,0, // vertex 3
-    34, 94,0, // vertex 4
-    28,94,0  // vertex 1
-  };
+/* Upload the queued bricks and draw them all in one call */
+void drawBricks ()
+{
+  int count = Bricks.Instances.size();
+  if (count == 0)
+    return;
+
+  glBindBuffer (GL_ARRAY_BUFFER, Bricks.InstanceBuffer);
+  if (count > Bricks.Capacity) {
+    int capacity = max(count, 2*Bricks.Capacity);
+    trackBytes((long)(capacity - Bricks.Capacity)*sizeof(BrickInstance));
+    Bricks.Capacity = capacity;
+  }
+  // Orphan last frame's storage so the upload does not wait on the GPU
+  glBufferData (GL_ARRAY_BUFFER, Bricks.Capacity*sizeof(BrickInstance), NULL, GL_STREAM_DRAW);
+  glBufferSubData (GL_ARRAY_BUFFER, 0, count*sizeof(BrickInstance), &Bricks.Instances[0]);
 
-  static const GLfloat color_buffer_data [] = {
-    1,0,0, // color 1
-    0,0,1, // color 2
-    0,1,0, // color 3
+  useProgram (Bricks.ProgramID);
+  setFillMode (GL_FILL);
+  bindVertexArray (Bricks.VertexArrayID);
+  glDrawArraysInstanced(GL_TRIANGLES, 0, 6, count);
+  useProgram (programID);
 
-    0,1,0, // color 3
-    0.3,0.3,0.3, // color 4
-    1,0,0  // color 1
-  };
+  Bricks.Instances.clear();
+}
 
-  // create3DObject creates and returns a handle to a VAO that can be used later
-  rectangle3 = create3DObject(GL_TRIANGLES, 6, vertex_buffer_data,0,0,0, GL_FILL);
+void releaseBrickRenderer ()
+{
+  if (!Bricks.VertexArrayID)
+    return;
+  releaseVertexArray(Bricks.VertexArrayID);
+  releaseBuffer(Bricks.QuadBuffer);
+  releaseBuffer(Bricks.InstanceBuffer);
+  trackBytes(-(long)(6*2*sizeof(GLfloat) + Bricks.Capacity*sizeof(BrickInstance)));
+  glDeleteProgram(Bricks.ProgramID);
+  Bricks.VertexArrayID = 0;
+  Bricks.Capacity = 0;
+}
 
-  //Obs1->r = 1;
-  //Obs1->CX = 1;
-  //Obs1->CY = 97;
+/* Per-instance data for the circle renderer - 16 bytes */
+struct CircleInstance {
+    GLfloat CentreX, CentreY;
+    GLfloat Radius;
+    GLubyte Color[4];
+};
 
-  if(Obs3_o == 0)
-  {
-    obj[3] = rectangle3;   
+/* Circles sharing a side count go out in one instanced draw */
+struct CircleGroup {
+    GLint Sides;
+    vector<CircleInstance> Instances;
+};
+
+/* Draws circles generated in Circle_GL.vert from gl_VertexID - the CPU
+   only sends centre, radius and colour per circle */
+struct CircleRenderer {
+    GLuint ProgramID;
+    GLuint SidesID;
+    GLuint VertexArrayID;
+    GLuint InstanceBuffer;
+    int Capacity;             // instances the buffer can hold
+    vector<CircleGroup> Groups;
+    vector<CircleInstance> Staging;
+    int Draws, LastDraws;
+    int Count, LastCount;
+    int Vertices, LastVertices;
+} Circles;
+
+void createCircleRenderer ()
+{
+  Circles.ProgramID = LoadShaders( "Circle_GL.vert", "Sample_GL.frag" );
+  bindCameraBlock(Circles.ProgramID);
+  Circles.SidesID = glGetUniformLocation(Circles.ProgramID, "Sides");
+
+  Circles.VertexArrayID = acquireVertexArray();
+  Circles.InstanceBuffer = acquireBuffer();
+  Circles.Capacity = 0;
+
+  bindVertexArray (Circles.VertexArrayID);
+  glBindBuffer (GL_ARRAY_BUFFER, Circles.InstanceBuffer);
+  for (GLuint attrib = 2; attrib <= 4; attrib++) {
+    glEnableVertexAttribArray(attrib);
+    glVertexAttribDivisor(attrib, 1);
   }
 }
 
-
-void whichbasket()
+/* Queue a filled circle for this frame's drawCircles call */
+void addCircle (GLfloat cx, GLfloat cy, GLfloat radius, GLint numberOfSides, GLfloat red, GLfloat green, GLfloat blue)
 {
-  if(Obs1_o == 0)
-  {
-  if(rectangle1->CX > X-12 && rectangle1->CY < X+12 && rectangle1->CY < Y+12 && rectangle1->CY > Y-12)
-    {
-      //cout<<"1"<<endl;
-      tim=0;
-      score -= 10;
-    }
-  else if(rectangle1->CX > x-12 && rectangle1->CY < x+12 && rectangle1->CY < y+12 && rectangle1->CY > y-12)
-    {
-      //cout<<"21"<<endl;
-      tim=0;
-      score += 10;
+  CircleInstance c;
+  c.CentreX = cx;
+  c.CentreY = cy;
+  c.Radius = radius;
+  c.Color[0] = VertexXYRGBA8::unorm8(red);
+  c.Color[1] = VertexXYRGBA8::unorm8(green);
+  c.Color[2] = VertexXYRGBA8::unorm8(blue);
+  c.Color[3] = 255;
+
+  for (size_t i = 0; i < Circles.Groups.size(); i++)
+    if (Circles.Groups[i].Sides == numberOfSides) {
+      Circles.Groups[i].Instances.push_back(c);
+      return;
     }
+  Circles.Groups.push_back(CircleGroup());
+  Circles.Groups.back().Sides = numberOfSides;
+  Circles.Groups.back().Instances.push_back(c);
+}
+
+/* Upload the queued circles and draw each side count in one call */
+void drawCircles ()
+{
+  Circles.Staging.clear();
+  for (size_t i = 0; i < Circles.Groups.size(); i++)
+    Circles.Staging.insert(Circles.Staging.end(), Circles.Groups[i].Instances.begin(), Circles.Groups[i].Instances.end());
+  int count = Circles.Staging.size();
+  if (count == 0)
+    return;
+
+  glBindBuffer (GL_ARRAY_BUFFER, Circles.InstanceBuffer);
+  if (count > Circles.Capacity) {
+    int capacity = max(count, 2*Circles.Capacity);
+    trackBytes((long)(capacity - Circles.Capacity)*sizeof(CircleInstance));
+    Circles.Capacity = capacity;
   }
-  if(Obs2_o == 0)
+  // Orphan last frame's storage so the upload does not wait on the GPU
+  glBufferData (GL_ARRAY_BUFFER, Circles.Capacity*sizeof(CircleInstance), NULL, GL_STREAM_DRAW);
+  glBufferSubData (GL_ARRAY_BUFFER, 0, count*sizeof(CircleInstance), &Circles.Staging[0]);
+
+  useProgram (Circles.ProgramID);
+  setFillMode (GL_FILL);
+  bindVertexArray (Circles.VertexArrayID);
+
+  // GL 3.3 has no base instance, so each group points the attributes at its own range
+  size_t first = 0;
+  for (size_t i = 0; i < Circles.Groups.size(); i++)
   {
-   if(rectangle2->CX > X-32 && rectangle2->CY < X+32 && rectangle2->CY < Y+32 && rectangle2->CY > Y-32)
-    {
-      //cout<<"1"<<endl;
-      tim2=0;
-      score += 10;
-    }
-  else if(rectangle2->CX > x-32 && rectangle2->CY < x+32 && rectangle2->CY < y+32 && rectangle2->CY > y-32)
-    {
-      //cout<<"22"<<endl;
-      tim2=0;
-      score -= 10;
-    }
+    CircleGroup& group = Circles.Groups[i];
+    if (group.Instances.empty())
+      continue;
+    size_t offset = first*sizeof(CircleInstance);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(CircleInstance), (void*)(offset + offsetof(CircleInstance, CentreX)));
+    glVertexAttribPointer(3, 1, GL_FLOAT, GL_FALSE, sizeof(CircleInstance), (void*)(offset + offsetof(CircleInstance, Radius)));
+    glVertexAttribPointer(4, 4, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(CircleInstance), (void*)(offset + offsetof(CircleInstance, Color)));
+    glUniform1i(Circles.SidesID, group.Sides);
+    glDrawArraysInstanced(GL_TRIANGLES, 0, 3*group.Sides, group.Instances.size());
+    Circles.Draws++;
+    Circles.Vertices += 3*group.Sides*group.Instances.size();
+    first += group.Instances.size();
+    group.Instances.clear();
   }
+  Circles.Count += count;
+  useProgram (programID);
+}
 
+/* Close the frame's circle counters */
+void endCircleFrame ()
+{
+  Circles.LastDraws = Circles.Draws;
+  Circles.LastCount = Circles.Count;
+  Circles.LastVertices = Circles.Vertices;
+  Circles.Draws = 0;
+  Circles.Count = 0;
+  Circles.Vertices = 0;
 }
 
-void checkCollision()
+void releaseCircleRenderer ()
 {
-  float x1 = -99 + p/10;
-  float y1 = 2+q/10;
-  float r1 = 1;
-  //cout<<x1<<"\t"<<y1<<endl;
-  float x2 , y2 , d1 , r2 , x3 , y3 , d2 , r3 , x4 , y4, d3 , r4;
-  x2 = obj[1]->CX;
-  y2 = 100 + obj[1]->CY; 
-  d1 = sqrt((x2-x1)*(x2-x1) + (y2-y1)*(y2-y1));
-  r2 = obj[1]->r;
-  if ( d1 < r1 + r2)
+  if (!Circles.VertexArrayID)
+    return;
+  releaseVertexArray(Circles.VertexArrayID);
+  releaseBuffer(Circles.InstanceBuffer);
+  trackBytes(-(long)Circles.Capacity*sizeof(CircleInstance));
+  glDeleteProgram(Circles.ProgramID);
+  Circles.VertexArrayID = 0;
+  Circles.Capacity = 0;
+}
+
+/* Counters for one frame of the shape batch */
+struct BatchStats {
+    int Draws;
+    int Vertices;
+    long Bytes;
+};
+
+// Stream buffers cycled by the batch; a buffer is reused only once its fence signals
+const int BATCH_RING_SIZE = 3;
+
+/* Collects the frame's triangles and lines in world space and draws them
+   with at most one glDrawArrays per primitive type */
+struct ShapeBatch {
+    vector<SceneVertex> Triangles;
+    vector<SceneVertex> Lines;
+    GLuint VertexArrays[BATCH_RING_SIZE];
+    GLuint Buffers[BATCH_RING_SIZE];
+    GLsync Fences[BATCH_RING_SIZE];
+    long Capacity[BATCH_RING_SIZE]; // bytes allocated in each buffer
+    int Current;
+    BatchStats Frame;               // the frame being built
+    BatchStats LastFrame;           // the last finished frame
+} Batch;
+
+void createShapeBatch ()
+{
+  for (int i = 0; i < BATCH_RING_SIZE; i++)
   {
-    Obs1_o = 1;
-    score++;
+    Batch.VertexArrays[i] = acquireVertexArray();
+    Batch.Buffers[i] = acquireBuffer();
+    Batch.Fences[i] = 0;
+    Batch.Capacity[i] = 0;
+
+    bindVertexArray (Batch.VertexArrays[i]);
+    glBindBuffer (GL_ARRAY_BUFFER, Batch.Buffers[i]);
+    SceneVertex::describe();
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(1);
   }
+  Batch.Current = 0;
+}
 
-  x3 = obj[2]->CX;
-  y3 = obj[2]->CY+100; 
-  d2 = sqrt((x3-x1)*(x3-x1) + (y3-y1)*(y3-y1));
-  r3 = obj[2]->r;
-  if ( d2 < r1 + r3)
+/* Transform n xyz vertices by model and append them as triangles */
+void batchTriangles (const glm::mat4& model, int numVertices, const GLfloat* vertex_buffer_data, GLfloat red, GLfloat green, GLfloat blue)
+{
+  for (int i = 0; i < numVertices; i++)
   {
-    Obs2_o = 1;
-    score++;
+    const GLfloat* v = &vertex_buffer_data[3*i];
+    glm::vec4 w = model * glm::vec4(v[0], v[1], v[2], 1);
+    Batch.Triangles.push_back(sceneVertex(w.x, w.y, w.z, red, green, blue));
   }
+}
 
-  x4 = obj[3]->CX;
-  y4 = obj[3]->CY+100; 
-  d3 = sqrt((x4-x1)*(x4-x1) + (y4-y1)*(y4-y1));
-  r4 = obj[3]->r;
-  if ( d3 < r1 + r4)
-  {
-    Obs3_o = 1;
-    score++;
+void batchLine (GLfloat x1, GLfloat y1, GLfloat x2, GLfloat y2, GLfloat red, GLfloat green, GLfloat blue)
+{
+  Batch.Lines.push_back(sceneVertex(x1, y1, 0, red, green, blue));
+  Batch.Lines.push_back(sceneVertex(x2, y2, 0, red, green, blue));
+}
+
+/* Stream everything queued since the last flush and draw it */
+void flushBatch ()
+{
+  int triangles = Batch.Triangles.size();
+  int lines = Batch.Lines.size();
+  if (triangles + lines == 0)
+    return;
+
+  int slot = Batch.Current;
+  Batch.Current = (Batch.Current + 1) % BATCH_RING_SIZE;
+
+  // Wait until the GPU is done with what this buffer held BATCH_RING_SIZE flushes ago
+  if (Batch.Fences[slot]) {
+    glClientWaitSync(Batch.Fences[slot], GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+    glDeleteSync(Batch.Fences[slot]);
+    Batch.Fences[slot] = 0;
   }
-  
+
+  long triangleBytes = triangles*sizeof(SceneVertex);
+  long lineBytes = lines*sizeof(SceneVertex);
+  glBindBuffer (GL_ARRAY_BUFFER, Batch.Buffers[slot]);
+  if (triangleBytes + lineBytes > Batch.Capacity[slot]) {
+    long capacity = max(triangleBytes + lineBytes, 2*Batch.Capacity[slot]);
+    glBufferData (GL_ARRAY_BUFFER, capacity, NULL, GL_STREAM_DRAW);
+    trackBytes(capacity - Batch.Capacity[slot]);
+    Batch.Capacity[slot] = capacity;
+  }
+  if (triangles)
+    glBufferSubData (GL_ARRAY_BUFFER, 0, triangleBytes, &Batch.Triangles[0]);
+  if (lines)
+    glBufferSubData (GL_ARRAY_BUFFER, triangleBytes, lineBytes, &Batch.Lines[0]);
+
+  // Vertices are already in world space
+  useProgram(programID);
+  uploadModel(glm::mat4(1.0f));
+  bindVertexArray (Batch.VertexArrays[slot]);
+  if (triangles) {
+    setFillMode (GL_FILL);
+    glDrawArrays(GL_TRIANGLES, 0, triangles);
+    Batch.Frame.Draws++;
+  }
+  if (lines) {
+    glDrawArrays(GL_LINES, triangles, lines);
+    Batch.Frame.Draws++;
+  }
+  Batch.Fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+
+  Batch.Frame.Vertices += triangles + lines;
+  Batch.Frame.Bytes += triangleBytes + lineBytes;
+  Batch.Triangles.clear();
+  Batch.Lines.clear();
 }
 
+/* Close the frame's counters - call once per frame after the last flush */
+void endBatchFrame ()
+{
+  Batch.LastFrame = Batch.Frame;
+  Batch.Frame.Draws = 0;
+  Batch.Frame.Vertices = 0;
+  Batch.Frame.Bytes = 0;
+}
 
+void releaseShapeBatch ()
+{
+  for (int i = 0; i < BATCH_RING_SIZE; i++)
+  {
+    if (!Batch.VertexArrays[i])
+      continue;
+    if (Batch.Fences[i])
+      glDeleteSync(Batch.Fences[i]);
+    releaseVertexArray(Batch.VertexArrays[i]);
+    releaseBuffer(Batch.Buffers[i]);
+    trackBytes(-Batch.Capacity[i]);
+    Batch.VertexArrays[i] = 0;
+    Batch.Fences[i] = 0;
+    Batch.Capacity[i] = 0;
+  }
+}
 
+/* Destroy every mesh and empty the name pool while the context is current */
+void releaseMeshes ()
+{
+  triangle.reset();
+  rectangle.reset();
+  line.reset();
+  circleCache.clear();
+  releaseBrickRenderer();
+  releaseShapeBatch();
+  releaseCircleRenderer();
+  releaseCameraBuffer();
+  drainGLPool();
+}
 
 
 float camera_rotation_angle = 90;
 float rectangle_rotation = 0;
 float triangle_rotation = 0;
 
-/* Render the scene with openGL */
-/* Edit this function according to your assignment */
-void draw ()
-{
-  // clear the color and depth in the frame buffer
-  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// Ticks run per frame at most; time beyond that is dropped so a stall slows the game instead of snowballing
+const int MAX_TICKS_PER_FRAME = 8;
 
-  // use the loaded shader program
-  // Don't change unless you know what you are doing
-  glUseProgram (programID);
+float lerp (float a, float b, double alpha)
+{
+  return a + (b - a) * alpha;
+}
 
-  // Eye - Location of camera. Don't change unless you are sure!!
-  glm::vec3 eye ( 5*cos(camera_rotation_angle*M_PI/180.0f), 0, 5*sin(camera_rotation_angle*M_PI/180.0f) );
-  // Target - Where is the camera looking at.  Don't change unless you are sure!!
-  glm::vec3 target (0, 0, 0);
-  // Up - Up vector defines tilt of camera.  Don't change unless you are sure!!
-  glm::vec3 up (0, 1, 0);
+/* A frame is built in two halves. The prepare functions below only read
+   the world and fill the CPU side queues (batch vertices, circle and brick
+   instances), each its own queue, so with batched rendering they run as
+   tasks of frameGraph on the job pool once the world has stepped. The
+   step is tasks too: the shots move in chunks, each its own shots,
+   alongside the bricks falling, and hits are worked out once both are
+   done. A small frame costs less than waking the workers does, so below
+   FRAME_GRAPH_MIN_WORK, or with fewer than two workers, prepareFrame() does
+   the same work in order on the main thread. The GL calls - beginFrame()
+   before, endFrame() after - stay on the main thread. Per-object rendering
+   creates GL objects as it goes, so draw() does everything there, in order. */
+
+// Shots and bricks a frame steps and queues before the job pool takes it on
+const size_t FRAME_GRAPH_MIN_WORK = 16384;
+
+JobPool* jobs;                // --threads workers
+TaskGraph frameGraph;
+int frameTicks;               // simulation ticks this frame
+double frameAlpha;            // how far the frame lies between previousState and world, 0..1
+double frameCharge;           // heldCharge() when the frame started
+int aimTarget = -1;           // brick Id the shot being charged would hit, or -1
+vector<vector<ShotMove> > shotMoves;  // each shots task's, in shot order
+vector<SpatialScratch> shotNear;      // each shots task's mirror scratch
+
+void simulateFrame ()
+{
+  const double dt = 1.0 / tickRate;
+  for (int i = 0; i < frameTicks; i++) {
+    previousState.capture(world);
+    world.step(dt);
+  }
+}
 
-  Matrices.view = glm::lookAt(glm::vec3(0,0,3), glm::vec3(0,0,0), glm::vec3(0,1,0)); // Fixed camera for 2D (ortho) in XY plane
-  glm::mat4 VP = Matrices.projection * Matrices.view;
+// The frame's ticks but the last, which the tasks below split up; frames
+// with more than one tick are catching up, so rare
+void beginTick ()
+{
+  const double dt = 1.0 / tickRate;
+  for (int i = 0; i + 1 < frameTicks; i++) {
+    previousState.capture(world);
+    world.step(dt);
+  }
+  if (frameTicks > 0) {
+    previousState.capture(world);
+    world.beginStep();
+  }
+}
 
-  glm::mat4 MVP;	// MVP = Projection * View * Model
+void moveShots (int task)
+{
+  if (frameTicks == 0)
+    return;
+  size_t n = world.Shots.size(), tasks = shotMoves.size();
+  shotMoves[task].clear();
+  world.moveShots(n * task / tasks, n * (task + 1) / tasks, 1.0 / tickRate, shotMoves[task], shotNear[task]);
+}
 
-  // Load identity to model matrix
+void fallBricks ()
+{
+  if (frameTicks > 0)
+    world.fallBricks(1.0 / tickRate, NULL);
+}
 
+void endTick ()
+{
+  if (frameTicks == 0)
+    return;
+  world.Moves.clear();
+  for (size_t t = 0; t < shotMoves.size(); t++)
+    world.Moves.insert(world.Moves.end(), shotMoves[t].begin(), shotMoves[t].end());
+  world.endStep(1.0 / tickRate);
+}
 
-  Matrices.model = glm::mat4(1.0f);
+glm::mat4 cannonModel (double alpha)
+{
   glm::mat4 tr = glm::translate (glm::vec3(99, -5, 0));        // glTranslatef
+  float rot_ang = lerp(previousState.rot_ang, world.rot_ang, alpha);
   glm::mat4 rr = glm::rotate((float)(rot_ang*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
   glm::mat4 tr1 = glm::translate (glm::vec3(-99, 5, 0));
-  Matrices.model *= (  tr1*rr*tr  );
+  return glm::mat4(1.0f) * (  tr1*rr*tr  );
+}
 
-  MVP = VP * Matrices.model;
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+// Where shot k of world is drawn
+void shotPosition (size_t k, double alpha, float& z1, float& z2)
+{
+  const Shot& shot = world.Shots.Active[k];
+  z1 = shot.x();
+  z2 = shot.y();
+  // A shot fired this tick has nowhere to come from, and its handle may
+  // have belonged to another shot last tick
+  float x0, y0;
+  if (previousState.shot(shot.Handle, shot.Launched, x0, y0)) {
+    z1 = lerp(x0, z1, alpha);
+    z2 = lerp(y0, z2, alpha);
+  }
+}
+
+void prepareAim ()
+{
+  long ticks;
+  aimTarget = charging ? outcomes.predict(world, frameCharge, ticks) : -1;
+}
+
+void prepareCannon (double alpha)
+{
+  batchTriangles(cannonModel(alpha), 6, cannon_vertex_data, 0, 0, 0);
+}
+
+void prepareCircles (double alpha)
+{
+  addCircle(lerp(previousState.x, world.x, alpha), lerp(previousState.y, world.y, alpha), 12, circleSides(12), 1, 1, 1);
+  addCircle(lerp(previousState.X, world.X, alpha), lerp(previousState.Y, world.Y, alpha), 12, circleSides(12), 0, 0, 0);
+  for (size_t k = 0; k < world.Shots.size(); k++)
+  {
+    float z1, z2;
+    shotPosition(k, alpha, z1, z2);
+    addCircle(z1, z2, 1, circleSides(1), 1, 1, 1);
+  }
+  if (aimTarget >= 0)
+  {
+    size_t i = world.Bricks.row(aimTarget);
+    addCircle(world.Bricks.X[i], world.Bricks.y(i), 1, circleSides(1), 1, 0, 0);
+  }
+}
+
+void prepareMirrors ()
+{
+  for (size_t i = 0; i < world.Mirrors.size(); i++) {
+    const Mirror& m = world.Mirrors.Segments[i];
+    batchLine(m.AX, m.AY, m.BX, m.BY, 1, 0, 0);
+  }
+}
+
+void prepareBricks (double alpha)
+{
+  // The brick with Id i is drawn in brickColors[i % 3]
+  static const GLfloat brickColors[3][3] = {
+    1,1,1,
+    0,0,0,
+    0,0,0
+  };
+  const BrickTable& bricks = world.Bricks;
+  const RenderState& before = previousState;
+  for (size_t i = 0; i < bricks.size(); i++)
+  {
+    const GLfloat* color = brickColors[bricks.Id[i] % 3];
+    // Don't blend across the jump back to the top, or with a different
+    // brick that a removal swapped into this slot
+    double phase = bricks.Phase[i];
+    if (i < before.BrickId.size() && before.BrickId[i] == bricks.Id[i] && phase >= before.BrickPhase[i])
+      phase = lerp(before.BrickPhase[i], phase, alpha);
+    addBrick(bricks.X[i] - bricks.Half[i], bricks.Y[i] - bricks.Half[i], color[0], color[1], color[2], phase);
+  }
+}
+
+// The step first: the shots, a chunk per worker, and the bricks between
+// its start and end. The rest only read the world, and the circles wait
+// for aim assist to pick its brick.
+void buildFrameGraph ()
+{
+  // Names outlive the graph, which keeps only the pointers
+  static vector<string> names(jobs->workers());
+  shotMoves.resize(names.size());
+  shotNear.resize(names.size());
+  int begin = frameGraph.add("begin tick", beginTick);
+  vector<int> moves;
+  for (size_t t = 0; t < names.size(); t++) {
+    names[t] = "shots " + to_string(t);
+    moves.push_back(frameGraph.add(names[t].c_str(), [t] { moveShots((int)t); }));
+  }
+  moves.push_back(frameGraph.add("fall", fallBricks));
+  int stepped = frameGraph.add("end tick", endTick);
+  for (size_t t = 0; t < moves.size(); t++) {
+    frameGraph.precede(begin, moves[t]);
+    frameGraph.precede(moves[t], stepped);
+  }
+
+  int aim = frameGraph.add("aim", prepareAim);
+  int cannon = frameGraph.add("cannon", [] { prepareCannon(frameAlpha); });
+  int circles = frameGraph.add("circles", [] { prepareCircles(frameAlpha); });
+  int mirrors = frameGraph.add("mirrors", prepareMirrors);
+  int brickQueue = frameGraph.add("bricks", [] { prepareBricks(frameAlpha); });
+  frameGraph.precede(stepped, aim);
+  frameGraph.precede(stepped, cannon);
+  frameGraph.precede(stepped, mirrors);
+  frameGraph.precede(stepped, brickQueue);
+  frameGraph.precede(aim, circles);
+  frameGraph.precede(stepped, circles);
+}
+
+// Whether the frame is big enough, and the pool wide enough, for the graph
+bool frameOnPool ()
+{
+  return jobs->workers() >= 2 && world.Shots.size() + world.Bricks.size() >= FRAME_GRAPH_MIN_WORK;
+}
+
+// frameGraph's work in order on this thread
+void prepareFrame ()
+{
+  simulateFrame();
+  prepareAim();
+  prepareCannon(frameAlpha);
+  prepareCircles(frameAlpha);
+  prepareMirrors();
+  prepareBricks(frameAlpha);
+}
+
+void beginFrame ()
+{
+  // clear the color and depth in the frame buffer
+  glClear (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+  // use the loaded shader program
+  // Don't change unless you know what you are doing
+  useProgram (programID);
+
+  // Camera block is only rewritten after a resize or camera change
+  updateCamera ();
 
-  // draw3DObject draws the VAO given to it using current MVP matrix
-  draw3DObject(rectangle);
   // Increment angles
   float increments = 1;
 
   //camera_rotation_angle++; // Simulating camera rotation
   triangle_rotation = triangle_rotation + increments*triangle_rot_dir*triangle_rot_status;
   rectangle_rotation = rectangle_rotation + increments*rectangle_rot_dir*rectangle_rot_status;
-  
+}
 
-  Matrices.model = glm::mat4(1.0f);
+void endFrame ()
+{
+  flushRenderQueue();
+  flushBatch();
+  endBatchFrame();
+  drawCircles();
+  endCircleFrame();
+  drawBricks();
+
+  endStateFrame();
+}
+
+/* Render the scene with openGL, one object at a time */
+/* Edit this function according to your assignment */
+void draw (double alpha)
+{
+  beginFrame();
+  prepareAim();
 
-  glm::mat4 translateCircle = glm::translate (glm::vec3(posX, posY, posZ));
-  
-  MVP = VP * Matrices.model;
+  // submit3DObject queues the VAO to be drawn with the given model matrix
+  Matrices.model = cannonModel(alpha);
+  submit3DObject(rectangle, Matrices.model);
 
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
+  float x = lerp(previousState.x, world.x, alpha), y = lerp(previousState.y, world.y, alpha);
+  float X = lerp(previousState.X, world.X, alpha), Y = lerp(previousState.Y, world.Y, alpha);
 
+  Matrices.model = circleModel(x, y, 0, 12);
+  submit3DObject(unitCircle(circleSides(12), 1, 1, 1), Matrices.model);
 
-  drawCircle1 (12, 360);
-  draw3DObject(circle1);
+  Matrices.model = circleModel(X, Y, 0, 12);
+  submit3DObject(unitCircle(circleSides(12), 0, 0, 0), Matrices.model);
 
-  drawCircle2 (12, 360);
-  draw3DObject(circle2);
+  for (size_t i = 0; i < world.Mirrors.size(); i++) {
+    Matrices.model = mirrorModel(world.Mirrors.Segments[i]);
+    submit3DObject(line, Matrices.model);
+  }
+
+  for (size_t k = 0; k < world.Shots.size(); k++)
+  {
+    float z1, z2;
+    shotPosition(k, alpha, z1, z2);
+    Matrices.model = circleModel(z1, z2, 0, 1);
+    submit3DObject(unitCircle(circleSides(1), 1, 1, 1), Matrices.model);
+  }
 
+  if (aimTarget >= 0)
+  {
+    size_t i = world.Bricks.row(aimTarget);
+    Matrices.model = circleModel(world.Bricks.X[i], world.Bricks.y(i), 0, 1);
+    submit3DObject(unitCircle(circleSides(1), 1, 0, 0), Matrices.model);
+  }
 
-  Matrices.model = glm::mat4(1.0f);
-  glm::mat4 translateLine1 = glm::translate (glm::vec3(72, -2, 0));
-  Matrices.model *= (translateLine1 );
-  glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-  drawline();
-  draw3DObject(line);
+  prepareBricks(alpha);
+  endFrame();
+}
 
-  if( flag == 1)
+/* Run the simulation with no window or GL context as fast as it goes and
+   report the step rate. A scripted player sweeps the cannon and fires again
+   as soon as the last shot has left the screen. */
+void runHeadless (long steps)
+{
+  World w;
+  w.Collision = world.Collision;
+  const double dt = 1.0 / tickRate;
+  const double charges[] = { 0.5, 1.0, 1.5, 2.0 };
+  long shots = 0, wins = 0, totalScore = 0;
+  WorldAction aim = AIM_UP;
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (long i = 0; i < steps; i++)
   {
-    float z1,z2;
-    z1 = -99 + p/10;
-    z2 = 2 + q/10;
-    //cout<<"\nz1 = "<<z1<<"\t"<<z2<<endl;
-    if( z1 > 99.0 || z2 > 100.0 || z2 < -100.0)
+    if (w.Shots.size() == 0)
     {
-      flag = 0;
-      p=0;
-      q=0;
-      u=15;
-      t=0;
+      if (w.rot_ang >= 50) aim = AIM_DOWN;
+      if (w.rot_ang <= -50) aim = AIM_UP;
+      WorldInput turn = { aim, 0 };
+      WorldInput fire = { FIRE, charges[shots % 4] };
+      w.apply(turn);
+      w.apply(fire);
+      shots++;
     }
-    drawCircle3 (0, 0, 0, 1,360);
-    Matrices.model = glm::mat4(1.0f);
-    glm::mat4 translateCircle = glm::translate (glm::vec3(z1, z2, 0 ));   // glTranslatef
-    Matrices.model *= (translateCircle);
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-    draw3DObject(circle3);
-    if( z2 == (2.4*z1 - 174.8))
+    w.step(dt);
+    if (w.Won)
     {
-      p = u*cos( 2*atan(2.4) + rot_ang*M_PI/180)*t;
-      q = u*sin( 2*atan(2.4) + rot_ang*M_PI/180)*t -t*t;
+      wins++;
+      totalScore += w.score;
+      w.reset();
     }
-    else
-    { 
-      p = u*cos(rot_ang*M_PI/180)*t;
-      q = u*sin(rot_ang*M_PI/180)*t -t*t;
+  }
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+  printf("headless: %ld steps in %.3f s, %.0f steps/s\n", steps, seconds, steps / seconds);
+  printf("headless: %ld shots, %ld levels cleared, %ld points\n", shots, wins, totalScore + w.score);
+  printf("headless: world hash %016llx\n", (unsigned long long)w.hash());
+}
+
+/* Play back a log written by --deterministic: the same inputs on the same
+   ticks, then check the world ends with the hash the log recorded. */
+int runReplay (const char* path)
+{
+  FILE* log = fopen(path, "r");
+  if (!log) {
+    fprintf(stderr, "replay: can't open %s\n", path);
+    return 1;
+  }
+  World w;
+  double dt = 1.0 / tickRate;
+  long inputs = 0, endTick = -1;
+  unsigned long long endHash = 0;
+
+  char line[256];
+  while (fgets(line, sizeof line, log))
+  {
+    long tick;
+    int action;
+    double charge, rate;
+    if (sscanf(line, "run %la %d", &rate, &action) == 2) {
+      dt = 1.0 / rate;
+      w.Collision = (CollisionMode)action;
+    }
+    else if (sscanf(line, "input %ld %d %la", &tick, &action, &charge) == 3) {
+      while (w.Ticks < tick)
+        w.step(dt);
+      WorldInput input = { (WorldAction)action, charge };
+      w.apply(input);
+      inputs++;
     }
-    t += 0.08;
+    else if (sscanf(line, "end %ld %llx", &endTick, &endHash) == 2)
+      break;
   }
+  fclose(log);
+  if (endTick < 0) {
+    fprintf(stderr, "replay: %s has no end line\n", path);
+    return 1;
+  }
+  while (w.Ticks < endTick)
+    w.step(dt);
+
+  unsigned long long hash = w.hash();
+  printf("replay: %ld inputs over %ld ticks, world hash %016llx (%s)\n", inputs, endTick, hash,
+         hash == endHash ? "matches" : "DIFFERS");
+  return hash == endHash ? 0 : 1;
+}
 
-  
-  
-  if( Obs1_o == 0)
+// The sweep --sweep and --bench-sweep play: every cannon angle with charges
+// of 0.05 s to 3 s, each given a minute of game time to clear the bricks
+static RolloutConfig sweepConfig ()
+{
+  RolloutConfig config = { world.Collision, 1.0 / tickRate, (long)(60 * tickRate) };
+  return config;
+}
+
+/* Play the whole sweep on --threads workers, streaming a CSV row per
+   rollout to path as it finishes, and report the rollout rate. */
+int runSweep (const char* path)
+{
+  FILE* csv = fopen(path, "w");
+  if (!csv) {
+    fprintf(stderr, "sweep: can't write %s\n", path);
+    return 1;
+  }
+  vector<RolloutSpec> specs = sweepSpecs(0.05, 3.0);
+  ParallelStats stats;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  vector<RolloutResult> results = runRollouts(specs, sweepConfig(), sweepThreads, csv, &stats);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  fclose(csv);
+
+  size_t cleared = 0;
+  for (size_t i = 0; i < results.size(); i++)
+    cleared += results[i].ClearTick >= 0;
+  printf("sweep: %zu rollouts on %d threads in %.3f s, %.0f rollouts/s, %zu steals\n",
+         specs.size(), stats.Threads, seconds, specs.size() / seconds, stats.Steals);
+  printf("sweep: %zu cleared the bricks, written to %s\n", cleared, path);
+  return 0;
+}
+
+/* Scaling: the same sweep on 1, 2, 4 .. threads up to the machine's (or
+   --threads), with the speedup over one thread, and a check that every
+   thread count gives the same results. */
+void benchSweep ()
+{
+  vector<RolloutSpec> specs = sweepSpecs(0.05, 3.0);
+  const int most = sweepThreads > 0 ? sweepThreads : hardwareThreads();
+  vector<RolloutResult> serial;
+  double serialRate = 0;
+
+  for (int threads = 1; ; threads = min(threads * 2, most))
   {
-    int temp=0;
-    float b1;
-    if(temp==0)
-      b1=0;
-    //cout<<"HELLO"<<endl;
-    Matrices.model = glm::mat4(1.0f);
-    
-    glm::mat4 translateObs1 = glm::translate (glm::vec3(0, -tim*tim, 0));       // glTranslatef
-    // glm::mat4 rotateRectangle = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-      
-    Matrices.model *= (translateObs1 );//rotateRectangle);
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-    draw3DObject(rectangle1);
-    //b1= -tim*tim;
-    tim+=0.02;
-    rectangle1->r = 7;
-    rectangle1->CX = 0;
-    rectangle1->CY = -tim*tim-3;
-
-    if(tim*tim >= 170)
-      tim =0;
-    
+    ParallelStats stats;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    vector<RolloutResult> results = runRollouts(specs, sweepConfig(), threads, NULL, &stats);
+    double rate = specs.size() / chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    if (threads == 1) {
+      serial = results;
+      serialRate = rate;
+    }
+    bool same = true;
+    for (size_t i = 0; i < results.size(); i++)
+      same = same && results[i].Shots == serial[i].Shots && results[i].Hits == serial[i].Hits
+                  && results[i].ClearTick == serial[i].ClearTick;
+
+    printf("sweep %3d threads: %8.0f rollouts/s  speedup %5.2fx  efficiency %3.0f%%  %5zu steals  %s\n",
+           threads, rate, rate / serialRate, 100 * rate / serialRate / threads, stats.Steals,
+           same ? "same results" : "RESULTS DIFFER");
+    if (threads == most)
+      break;
   }
+}
 
+/* Work out the outcome table for the level at --tick-rate on --threads
+   workers and write it to path. */
+int buildOutcomes (const char* path)
+{
+  ParallelStats stats;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  size_t entries = buildOutcomeTable(path, tickRate, 3.0, sweepThreads, &stats);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+  if (entries == 0) {
+    fprintf(stderr, "outcomes: can't write %s\n", path);
+    return 1;
+  }
+  printf("outcomes: %zu entries (%zu KB) on %d threads in %.3f s, written to %s\n", entries,
+         (entries * sizeof(uint16_t) + sizeof(OutcomeHeader)) / 1024, stats.Threads, seconds, path);
+  return 0;
+}
 
-  if( Obs2_o == 0)
+/* Check the table against the game: fire shots at random angles, charges
+   and moments, play each out in the --collision mode, and compare the first
+   brick it hits and when with what the table said. Half the charges fall
+   between whole ticks, as held keys do, and are fired in whole ticks as
+   the game fires them. Then time a lookup. */
+int checkOutcomes (const char* path)
+{
+  OutcomeTable table;
+  if (!table.open(path, tickRate)) {
+    fprintf(stderr, "outcomes: %s is missing or was built for another level or tick rate\n", path);
+    return 1;
+  }
+  const double dt = 1.0 / tickRate;
+  const int trials = 2000;
+  int hits = 0, agree = 0, between = 0;
+  srand(1);
+  for (int n = 0; n < trials; n++)
   {
-    
-    //cout<<"HELLO"<<endl;
-    Matrices.model = glm::mat4(1.0f);
-    
-    glm::mat4 translateObs2 = glm::translate (glm::vec3(0, -tim2*tim2, 0));       // glTranslatef
-    // glm::mat4 rotateRectangle = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-      
-    Matrices.model *= (translateObs2 );//rotateRectangle);
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-    draw3DObject(rectangle2);
-    //b1= -tim*tim;
-    
-    tim2+=0.03;
-    rectangle2->r = 7;
-    rectangle2->CX = 0;
-    rectangle2->CY = -tim2*tim2-3;
+    World w;
+    w.Collision = world.Collision;
+    long launch = rand() % 2000;
+    while (w.Ticks < launch)
+      w.step(dt);
+    w.rot_ang = (float)(5 * (rand() % 21) - 50);
+    double charge = (rand() % table.header()->Charges) / tickRate;
+    if (n % 2) {
+      // Up to just under half a tick either way, so it rounds back
+      charge += (rand() % 1000 - 500) / 1001.0 / tickRate;
+      between++;
+    }
+    long predicted = -1;
+    int target = table.predict(w, charge, predicted);
+
+    WorldInput fire = { FIRE, tickCharge(charge) };
+    w.apply(fire);
+    int actual = -1;
+    long when = -1;
+    while (actual < 0 && w.Shots.size() > 0) {
+      vector<int> before(w.Bricks.Id);
+      w.step(dt);
+      for (size_t i = 0; i < before.size() && actual < 0; i++)
+        if (w.Bricks.row(before[i]) < 0) {
+          actual = before[i];
+          when = w.Ticks - launch;
+        }
+    }
+    hits += actual >= 0;
+    agree += actual == target && (actual < 0 || when == predicted);
+  }
+  printf("outcomes: %d of %d shots as the table said, %d of them hits, %d held between ticks (%s collision)\n",
+         agree, trials, hits, between, COLLISION_MODE_NAMES[world.Collision]);
+
+  World w;
+  const int lookups = 1000000;
+  long ticks, sum = 0;
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  for (int n = 0; n < lookups; n++) {
+    w.rot_ang = (float)(5 * (n % 21) - 50);
+    sum += table.predict(w, (n % 180) / tickRate, ticks);
+  }
+  double ns = chrono::duration<double>(chrono::steady_clock::now() - start).count() * 1e9 / lookups;
+  printf("outcomes: %.1f ns per lookup (%ld)\n", ns, sum);
+  return agree == trials ? 0 : 1;
+}
+
+/* Find the fewest shots that clear the level, or with bricks a level of
+   that many random ones, and print them. For the standard level the input
+   and end lines are a --deterministic log, so --replay can check them. */
+int runSolver (int bricks)
+{
+  World start;
+  start.Collision = world.Collision;
+  if (bricks > 0) {
+    srand(1);
+    start.Bricks.clear();
+    for (int i = 0; i < bricks; i++)
+      start.addBrick(-90 + 180.0 * rand() / RAND_MAX, -60 + 150.0 * rand() / RAND_MAX, 0.5 + 2.0 * rand() / RAND_MAX);
+  }
 
-    if(tim2*tim2 >= 170)
-      tim2=0;
+  // Shots every 1/6 s over 5 s apart, charges every 1/12 s up to 3 s
+  SolverConfig config = { 1.0 / tickRate, 32, (int)start.Bricks.size(),
+                          max(1, (int)lround(tickRate / 6)), (int)lround(5 * tickRate),
+                          max(1, (int)lround(tickRate / 12)), (int)lround(3 * tickRate), sweepThreads };
+  chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+  SolverResult r = solveLevel(start, config);
+  double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+
+  printf("solve: %zu shots tried in %.3f s, %.0f shots/s, %zu cached states, %zu pruned by the cache\n",
+         r.Shots, seconds, r.Shots / seconds, r.States, r.Pruned);
+  if (!r.Solved) {
+    printf("solve: no way to clear %zu bricks in %d shots\n", start.Bricks.size(), config.MaxShots);
+    return 1;
+  }
+  printf("solve: %zu shots (%s), won on tick %ld\n", r.Actions.size(),
+         r.Exhaustive ? "the fewest possible" : "the fewest found, the beam was full", r.WonTick);
+  if (bricks > 0) {
+    for (size_t k = 0; k < r.Actions.size(); k++)
+      printf("shot tick %ld angle %d charge %g\n", r.Actions[k].Tick, r.Actions[k].Angle, r.Actions[k].Charge);
+    return r.WonTick >= 0 ? 0 : 1;
+  }
 
+  // The inputs fireAction makes, in --deterministic's log
+  printf("run %a %d\n", tickRate, (int)start.Collision);
+  float angle = start.rot_ang;
+  for (size_t k = 0; k < r.Actions.size(); k++) {
+    const SolverAction& a = r.Actions[k];
+    for (; angle < a.Angle; angle += 5)
+      printf("input %ld %d %a\n", a.Tick, (int)AIM_UP, 0.0);
+    for (; angle > a.Angle; angle -= 5)
+      printf("input %ld %d %a\n", a.Tick, (int)AIM_DOWN, 0.0);
+    printf("input %ld %d %a\n", a.Tick, (int)FIRE, a.Charge);
   }
+  if (r.WonTick < 0)
+    return 1;
+  World w = start;
+  size_t k = 0;
+  while (w.Ticks < r.WonTick) {
+    while (k < r.Actions.size() && r.Actions[k].Tick == w.Ticks)
+      fireAction(w, r.Actions[k++]);
+    w.step(1.0 / tickRate);
+  }
+  printf("end %ld %016llx\n", w.Ticks, (unsigned long long)w.hash());
+  return 0;
+}
 
-  if( Obs3_o == 0)
+/* Steps batches of 1 to 4096 games through the C interface with a random
+   policy that fires about once a second, and reports game steps per second. */
+void benchEnvs ()
+{
+  const int sizes[] = { 1, 64, 1024, 4096 };
+  for (int s = 0; s < 4; s++)
   {
-    
-    //cout<<"HELLO"<<endl;
-    Matrices.model = glm::mat4(1.0f);
-    
-    glm::mat4 translateObs2 = glm::translate (glm::vec3(0, -tim3*tim3, 0));       // glTranslatef
-    // glm::mat4 rotateRectangle = glm::rotate((float)(rectangle_rotation*M_PI/180.0f), glm::vec3(0,0,1)); // rotate about vector (-1,1,1)
-      
-    Matrices.model *= (translateObs2 );//rotateRectangle);
-    MVP = VP * Matrices.model;
-    glUniformMatrix4fv(Matrices.MatrixID, 1, GL_FALSE, &MVP[0][0]);
-
-    // draw3DObject draws the VAO given to it using current MVP matrix
-    draw3DObject(rectangle3);
-    //b1= -tim*tim;
-    
-    tim3+=0.04;
-    rectangle3->r = 7;
-    rectangle3->CX = 0;
-    rectangle3->CY = -tim3*tim3-3;
+    int n = sizes[s];
+    EnvBatch* batch = envbatch_create(n, 16, tickRate, world.Collision, 1, (int64_t)(60 * tickRate));
+    vector<int32_t> actions(n);
+    vector<float> charges(n, 1.5f);
+    unsigned seed = 1;
+    const long total = 4000000;
+    long steps = max(1L, total / n), finished = 0;
+
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (long i = 0; i < steps; i++) {
+      for (int e = 0; e < n; e++) {
+        seed = seed * 1664525u + 1013904223u;
+        int r = (seed >> 16) % 256;
+        actions[e] = r < 4 ? ENVBATCH_FIRE : r < 14 ? r % 6 : ENVBATCH_NOOP;
+      }
+      finished += envbatch_step(batch, actions.data(), charges.data());
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    printf("%5d games: %10.0f game steps/s  %ld games finished\n", n, n * steps / seconds, finished);
+    envbatch_destroy(batch);
+  }
+}
 
-    if(tim3*tim3 >= 170)
-      tim3=0;
+// Empties the queues a frame fills, in place of drawing them
+void discardFrame ()
+{
+  Batch.Triangles.clear();
+  Batch.Lines.clear();
+  for (size_t i = 0; i < Circles.Groups.size(); i++)
+    Circles.Groups[i].Instances.clear();
+  Bricks.Instances.clear();
+}
 
+/* The frame's task graph with no window, on a level of 2000 bricks and
+   one of 20000, either side of FRAME_GRAPH_MIN_WORK: a shot fired every 10
+   frames, each frame one tick, with every queue filled and then emptied
+   instead of drawn. Times it on the job pool against the same work in
+   order on one thread, says which the game would pick, then dumps the
+   per-task timings. */
+void benchJobs ()
+{
+  JobPool pool(sweepThreads);
+  jobs = &pool;
+  buildFrameGraph();
+  frameTicks = 1;
+  frameAlpha = 0.5;
+  const int levels[] = { 2000, 20000 };
+
+  for (int l = 0; l < 2; l++)
+  {
+    world.reset();
+    srand(1);
+    for (int i = 0; i < levels[l]; i++)
+      world.addBrick(-90 + 180.0 * rand() / RAND_MAX, -60 + 150.0 * rand() / RAND_MAX, 0.5 + 2.0 * rand() / RAND_MAX);
+    World start = world;
+    const int frames = 40000000 / levels[l];
+    printf("%d bricks, the game runs frames %s:\n", levels[l], frameOnPool() ? "on the pool" : "on one thread");
+    frameGraph.resetTimings();
+
+    for (int pass = 0; pass < 2; pass++)
+    {
+      world = start;
+      previousState.capture(world);
+      chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+      for (int f = 0; f < frames; f++) {
+        if (f % 10 == 0) {
+          WorldInput fire = { FIRE, 1.0 + (f / 10 % 8) * 0.25 };
+          world.apply(fire);
+        }
+        if (pass == 0)
+          pool.run(frameGraph);
+        else
+          prepareFrame();
+        discardFrame();
+      }
+      double seconds = chrono::duration<double>(chrono::steady_clock::now() - begin).count();
+      printf("  %s: %.0f frames/s, %.1f us per frame, world hash %016llx\n",
+             pass == 0 ? "task graph" : "one thread", frames / seconds, 1e6 * seconds / frames,
+             (unsigned long long)world.hash());
+    }
   }
+  printf("Frame tasks on %d workers, %d bricks:\n", pool.workers(), levels[1]);
+  frameGraph.dumpTimings(stdout);
+}
+
+/* Keeps up to 4096 shots in flight at once, refilling the pool every step
+   with shots at spread out angles and charges, through a field of 200
+   bricks, and reports the step cost per shot in each collision mode. Each
+   world's pool is sized for its count up front; it checks that the pool's
+   storage never moved, and reports the room the scheduled hits grew to. */
+void benchShots ()
+{
+  const double dt = 1.0 / tickRate;
+  const int steps = 2000;
+  const size_t targets[] = { 1, 100, 1000, SHOT_CAPACITY };
+
+  for (int m = 0; m < 3; m++)
+    for (int n = 0; n < 4; n++)
+    {
+      World w(targets[n]);
+      w.Collision = (CollisionMode)m;
+      srand(1);
+      for (int i = 0; i < 200; i++)
+        w.addBrick(-90 + 180.0 * rand() / RAND_MAX, -60 + 150.0 * rand() / RAND_MAX, 0.5 + 2.0 * rand() / RAND_MAX);
+      const Shot* storage = w.Shots.Active.data();
+
+      long fired = 0, shotSteps = 0;
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      for (int i = 0; i < steps; i++)
+      {
+        while (w.Shots.size() < targets[n])
+        {
+          w.rot_ang = (float)(fired * 7 % 101 - 50);
+          WorldInput fire = { FIRE, 0.5 + 1.5 * (fired % 13) / 13 };
+          w.apply(fire);
+          fired++;
+        }
+        shotSteps += w.Shots.size();
+        w.step(dt);
+      }
+      double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
 
+      printf("%-12s %4zu shots: %9.0f ns/step %6.1f ns/shot, %6ld fired, %4d points, pool %s, room for %zu hits\n",
+             COLLISION_MODE_NAMES[m], targets[n], ns / steps, ns / shotSteps, fired, w.score,
+             w.Shots.Active.data() == storage ? "never moved" : "MOVED", w.Scheduled.capacity());
+    }
+}
+
+/* 1000 shots in flight through fields of 1 to 1000 short mirrors, at
+   random angles, and 100 bricks; reports the step cost per shot in each
+   collision mode and how often shots bounce. */
+void benchMirrors ()
+{
+  const double dt = 1.0 / tickRate;
+  const int steps = 1000;
+  const int fields[] = { 1, 10, 100, 300, 1000 };
+
+  for (int m = 0; m < 3; m++)
+    for (int n = 0; n < 5; n++)
+    {
+      World w;
+      w.Collision = (CollisionMode)m;
+      w.Mirrors.clear();
+      srand(1);
+      for (int i = 0; i < fields[n]; i++) {
+        double x = -90 + 180.0 * rand() / RAND_MAX, y = -80 + 170.0 * rand() / RAND_MAX;
+        double a = M_PI * rand() / RAND_MAX;
+        w.addMirror(x, y, x + 6 * cos(a), y + 6 * sin(a));
+      }
+      for (int i = 0; i < 100; i++)
+        w.addBrick(-90 + 180.0 * rand() / RAND_MAX, -60 + 150.0 * rand() / RAND_MAX, 0.5 + 2.0 * rand() / RAND_MAX);
+
+      long fired = 0, shotSteps = 0, bounces = 0;
+      chrono::steady_clock::time_point start = chrono::steady_clock::now();
+      for (int i = 0; i < steps; i++)
+      {
+        while (w.Shots.size() < 1000)
+        {
+          w.rot_ang = (float)(fired * 7 % 101 - 50);
+          WorldInput fire = { FIRE, 0.5 + 1.5 * (fired % 13) / 13 };
+          w.apply(fire);
+          fired++;
+        }
+        shotSteps += w.Shots.size();
+        w.step(dt);
+        for (size_t k = 0; k < w.Shots.size(); k++)
+          bounces += w.Shots.Active[k].t < 0.08 * dt * WORLD_REFERENCE_HZ;
+      }
+      double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count();
 
-  if( Obs1_o == 1 && Obs2_o == 1 && Obs3_o == 1)
+      printf("%-12s %4d mirrors: %6.1f ns/shot, %5.2f%% of shot steps bounce, %3d points\n",
+             COLLISION_MODE_NAMES[m], fields[n], ns / shotSteps, 100.0 * bounces / shotSteps, w.score);
+    }
+}
+
+/* Micro-benchmark: cost per shot/brick pair of each collision test over one
+   step, on shots of up to 20x the base speed aimed to pass near the brick.
+   Misses and extras are counted against the exact planned contact. */
+void benchCollision ()
+{
+  const int pairs = 200000;
+  const double dt = 1.0 / tickRate;
+  vector<ShotPath> paths(pairs);
+  vector<BrickFall> falls(pairs);
+
+  srand(1);
+  World w;
+  for (int k = 0; k < pairs; k++)
+  {
+    int i = rand() % WORLD_BRICKS;
+    w.Bricks.Phase[i] = sqrt(170.0) * rand() / RAND_MAX;
+    Shot shot = Shot();
+    double speed = 15 * (0.5 + 7.5 * rand() / RAND_MAX) * 2.5;
+    shot.aim((100.0 * rand() / RAND_MAX - 50) * M_PI / 180, speed);
+    shot.t = 2.0 * rand() / RAND_MAX;
+    ShotPath path = w.shotPath(shot);
+    BrickFall fall = w.brickFall(i);
+
+    // Put the shot somewhere around the brick partway through the step
+    double s = dt * rand() / RAND_MAX;
+    double reach = fall.half + 5;
+    double phase = fall.phase + fall.rate * s;
+    double tx = fall.cx + reach * (2.0 * rand() / RAND_MAX - 1);
+    double ty = fall.cy - phase * phase + reach * (2.0 * rand() / RAND_MAX - 1);
+    path.x[0] += tx - (path.x[0] + path.x[1] * s);
+    path.y[0] += ty - (path.y[0] + path.y[1] * s + path.y[2] * s * s);
+    paths[k] = path;
+    falls[k] = fall;
+  }
+
+  vector<char> exact(pairs);
+  const char* names[] = { "planned", "swept", "conservative", "sampled", "planned (flight)" };
+  for (int m = 0; m < 5; m++)
   {
-    float z1 = -99 + p/10;
-    float z2 = 2 + q/10;
-    if( z1 > 99.0 || z2 > 100.0 || z2 < -100.0 )
+    long hits = 0, missed = 0, extra = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int k = 0; k < pairs; k++)
     {
-      cout<<endl<<endl<<"YOU WON!!!  SCORE: "<<score<<endl;
-    exit(0);
+      const ShotPath& path = paths[k];
+      const BrickFall& fall = falls[k];
+      double r = 1;   // SHOT_RADIUS
+      double hit = -1;
+      switch (m) {
+        case 0:
+          hit = planContact(path, fall, r, 0, dt);
+          break;
+        case 1: {
+          double end = fall.phase + fall.rate * dt;
+          HitBox from = { fall.cx, fall.cy - fall.phase * fall.phase, fall.half };
+          HitBox to = { fall.cx, fall.cy - end * end, fall.half };
+          hit = sweptContact(path.x[0], path.y[0], path.x[0] + path.x[1] * dt,
+                             path.y[0] + path.y[1] * dt + path.y[2] * dt * dt, r, from, to);
+          break;
+        }
+        case 2:
+          hit = advanceContact(path, fall, r, 0, dt, ADVANCE_TOLERANCE);
+          break;
+        case 3:   // one look at the end of the step, like the old distance test
+          hit = advanceContact(path, fall, r, dt, dt, 0);
+          break;
+        case 4:   // what a plan costs: the whole flight at once
+          hit = planContact(path, fall, r, 0, 2);
+          break;
+      }
+      if (m == 0)
+        exact[k] = hit >= 0;
+      if (hit >= 0)
+        hits++;
+      if (m < 4) {
+        missed += exact[k] && hit < 0;
+        extra += !exact[k] && hit >= 0;
+      }
+    }
+    double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / pairs;
+    if (m < 4)
+      printf("collision %-17s %7.1f ns/pair  %6ld hits  %5ld missed  %5ld extra\n", names[m], ns, hits, missed, extra);
+    else
+      printf("collision %-17s %7.1f ns/pair  %6ld hits\n", names[m], ns, hits);
   }
 }
 
+/* Brick step benchmark: fall and test n bricks against one shot with each
+   kernel, next to the loop it replaced - a sqrt distance to each brick's
+   centre, a lighter test than the swept box. Speed-ups are against the
+   scalar kernel, and every kernel has to leave the same phases and masks. */
+void benchBricks ()
+{
+  const double dt = 1.0 / tickRate;
+  const int sizes[] = { 1000, 100000, 1000000 };
 
-  checkCollision();
-  //whichbasket();
+  srand(1);
+  for (int s = 0; s < 3; s++)
+  {
+    size_t n = sizes[s];
+    BrickTable table;
+    for (size_t i = 0; i < n; i++) {
+      table.add(200.0 * rand() / RAND_MAX - 100, 200.0 * rand() / RAND_MAX - 100, 3, 1 + 2.0 * rand() / RAND_MAX);
+      table.Phase[i] = sqrt(170.0) * rand() / RAND_MAX;
+    }
+    vector<double> start = table.Phase;
+    vector<uint64_t> wrapped((n + 63) / 64), hits((n + 63) / 64);
+    vector<unsigned> indices(n);
+    int iterations = max<int>(20, 20000000 / n);
+
+    // The old way: advance, then a sqrt distance to every brick
+    vector<double> phase = start;
+    long found = 0;
+    chrono::steady_clock::time_point begin = chrono::steady_clock::now();
+    for (int it = 0; it < iterations; it++)
+      for (size_t i = 0; i < n; i++) {
+        phase[i] += table.Rate[i] * dt;
+        if (phase[i] * phase[i] >= 170)
+          phase[i] = 0;
+        double dx = table.X[i] - 10, dy = table.Y[i] - phase[i] * phase[i] - 20;
+        found += sqrt(dx*dx + dy*dy) < 12;
+      }
+    double referenceNs = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / iterations / n;
+    printf("bricks %7zu  %-9s %6.2f ns/brick  (%ld near)\n", n, "reference", referenceNs, found);
+
+    double scalarNs = 0;
+    vector<double> scalarPhase;
+    vector<uint64_t> scalarWrapped, scalarHits;
+    for (int k = BRICK_KERNEL_SCALAR; k <= brickKernel; k++)
+    {
+      table.Phase = start;
+      BrickStep step = { table.X.data(), table.Y.data(), table.Half.data(), table.Phase.data(), table.Rate.data(),
+                         n, dt, 170, 0, 10, 20, 12, wrapped.data(), hits.data() };
+      size_t near = 0;
+      begin = chrono::steady_clock::now();
+      for (int it = 0; it < iterations; it++) {
+        stepBricks(step, (BrickKernel)k);
+        near += maskIndices(hits.data(), n, indices.data());
+      }
+      double ns = chrono::duration<double, nano>(chrono::steady_clock::now() - begin).count() / iterations / n;
+
+      if (k == BRICK_KERNEL_SCALAR) {
+        scalarNs = ns;
+        scalarPhase = table.Phase;
+        scalarWrapped = wrapped;
+        scalarHits = hits;
+      }
+      bool same = table.Phase == scalarPhase && wrapped == scalarWrapped && hits == scalarHits;
+      printf("bricks %7zu  %-9s %6.2f ns/brick  %6.1fx  (%zu near, %s)\n", n, BRICK_KERNEL_NAMES[k], ns,
+             scalarNs / ns, near, same ? "same as scalar" : "DIFFERS FROM SCALAR");
+    }
+  }
+}
+
+/* Scaling benchmark for the broad phase: bricks scattered at a fixed density
+   over an area that grows with their count, falling as in the game. Each
+   tick the grid is rebuilt, then shots moving up to 10 units a step look up
+   their candidates and run the swept test on them; brute force tests every
+   brick, on fewer shots once that gets slow. */
+void benchBroadPhase ()
+{
+  const double dt = 1.0 / tickRate;
+  const int shots = 100000;
+  SpatialHash grid;
+  vector<int> candidates;
+
+  srand(1);
+  for (int bricks = 10; bricks <= 1000000; bricks *= 10)
+  {
+    double side = 24 * sqrt((double)bricks);   // about one brick per 24x24 units
+    vector<BrickFall> falls(bricks);
+    for (int i = 0; i < bricks; i++) {
+      BrickFall f = { side * rand() / RAND_MAX, side * rand() / RAND_MAX, 7,
+                      sqrt(170.0) * rand() / RAND_MAX, 1 + 2.0 * rand() / RAND_MAX };
+      falls[i] = f;
+    }
+
+    const int ticks = max(10, 1000000 / bricks);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int t = 0; t < ticks; t++)
+    {
+      grid.clear();
+      for (int i = 0; i < bricks; i++) {
+        BrickFall& f = falls[i];
+        f.phase += f.rate * dt;
+        if (f.phase * f.phase >= 170)
+          f.phase = 0;
+        double end = f.phase + f.rate * dt;
+        grid.insert(i, f.cx - f.half, f.cy - end * end - f.half, f.cx + f.half, f.cy - f.phase * f.phase + f.half);
+      }
+      grid.build();
+    }
+    double buildNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / ticks;
+
+    vector<float> from(2 * shots), to(2 * shots);
+    for (int k = 0; k < shots; k++) {
+      from[2*k] = side * rand() / RAND_MAX;
+      from[2*k + 1] = side * rand() / RAND_MAX;
+      to[2*k] = from[2*k] + 20.0 * rand() / RAND_MAX - 10;
+      to[2*k + 1] = from[2*k + 1] + 20.0 * rand() / RAND_MAX - 10;
+    }
+
+    long gridHits = 0, tested = 0;
+    start = chrono::steady_clock::now();
+    for (int k = 0; k < shots; k++)
+    {
+      float x0 = from[2*k], y0 = from[2*k + 1], x1 = to[2*k], y1 = to[2*k + 1];
+      candidates.clear();
+      grid.query(min(x0, x1) - 1, min(y0, y1) - 1, max(x0, x1) + 1, max(y0, y1) + 1, candidates);
+      tested += candidates.size();
+      for (size_t c = 0; c < candidates.size(); c++) {
+        const BrickFall& f = falls[candidates[c]];
+        double end = f.phase + f.rate * dt;
+        HitBox a = { f.cx, f.cy - f.phase * f.phase, f.half }, b = { f.cx, f.cy - end * end, f.half };
+        gridHits += sweptContact(x0, y0, x1, y1, 1, a, b) >= 0;
+      }
+    }
+    double gridNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / shots;
+
+    int bruteShots = (int)min<long>(shots, 100000000L / bricks);
+    long bruteHits = 0, gridHitsSame = 0;
+    start = chrono::steady_clock::now();
+    for (int k = 0; k < bruteShots; k++)
+    {
+      float x0 = from[2*k], y0 = from[2*k + 1], x1 = to[2*k], y1 = to[2*k + 1];
+      for (int i = 0; i < bricks; i++) {
+        const BrickFall& f = falls[i];
+        double end = f.phase + f.rate * dt;
+        HitBox a = { f.cx, f.cy - f.phase * f.phase, f.half }, b = { f.cx, f.cy - end * end, f.half };
+        bruteHits += sweptContact(x0, y0, x1, y1, 1, a, b) >= 0;
+      }
+    }
+    double bruteNs = chrono::duration<double, nano>(chrono::steady_clock::now() - start).count() / bruteShots;
+
+    // The grid must find every hit brute force does, on the shots both ran
+    for (int k = 0; k < bruteShots; k++)
+    {
+      float x0 = from[2*k], y0 = from[2*k + 1], x1 = to[2*k], y1 = to[2*k + 1];
+      candidates.clear();
+      grid.query(min(x0, x1) - 1, min(y0, y1) - 1, max(x0, x1) + 1, max(y0, y1) + 1, candidates);
+      for (size_t c = 0; c < candidates.size(); c++) {
+        const BrickFall& f = falls[candidates[c]];
+        double end = f.phase + f.rate * dt;
+        HitBox a = { f.cx, f.cy - f.phase * f.phase, f.half }, b = { f.cx, f.cy - end * end, f.half };
+        gridHitsSame += sweptContact(x0, y0, x1, y1, 1, a, b) >= 0;
+      }
+    }
+
+    printf("broad phase %7d bricks  rebuild %6.1f ns/brick  query %8.1f ns/shot (%4.1f candidates, %ld hits)"
+           "  brute force %12.1f ns/shot (%s)\n",
+           bricks, buildNs / bricks, gridNs, (double)tested / shots, gridHits, bruteNs,
+           bruteHits == gridHitsSame ? "same hits" : "HITS DIFFER");
+  }
 }
 
 /* Initialise glfw window, I/O callbacks and the renderer to use */
@@ -984,14 +2648,18 @@ void initGL (GLFWwindow* window, int width, int height)
 	// Create the models
 	createTriangle (); // Generate the VAO, VBOs, vertices data & copy into the array buffer
 	createRectangle ();
-  createRectangle1 ();
-  createRectangle2 ();
-  createRectangle3 ();
+  createCircles ();
+  drawline ();
 	//createObs1();
 	// Create and compile our GLSL program from the shaders
 	programID = LoadShaders( "Sample_GL.vert", "Sample_GL.frag" );
-	// Get a handle for our "MVP" uniform
-	Matrices.MatrixID = glGetUniformLocation(programID, "MVP");
+	// Get a handle for our "Model" uniform; VP comes from the Camera block
+	Matrices.MatrixID = glGetUniformLocation(programID, "Model");
+	createCameraBuffer ();
+	bindCameraBlock (programID);
+	createBrickRenderer ();
+	createShapeBatch ();
+	createCircleRenderer ();
 
 	
 	reshapeWindow (window, width, height);
@@ -1014,17 +2682,140 @@ int main (int argc, char** argv)
 	int width = 600;
 	int height = 600;
 
+    for (int i = 1; i < argc; i++)
+        if (strcmp(argv[i], "--deterministic") == 0)
+            deterministic = true;
+    for (int i = 1; i + 1 < argc; i++)
+    {
+        if (strcmp(argv[i], "--tick-rate") == 0 && atof(argv[i + 1]) > 0)
+            tickRate = atof(argv[i + 1]);
+        if (strcmp(argv[i], "--threads") == 0)
+            sweepThreads = atoi(argv[i + 1]);
+        if (strcmp(argv[i], "--outcomes") == 0)
+            outcomesPath = argv[i + 1];
+        for (int m = COLLIDE_PLANNED; m <= COLLIDE_CONSERVATIVE; m++)
+            if (strcmp(argv[i], "--collision") == 0 && strcmp(argv[i + 1], COLLISION_MODE_NAMES[m]) == 0)
+                world.Collision = (CollisionMode)m;
+    }
+
+    if (argc > 1 && strcmp(argv[1], "--headless") == 0) {
+        runHeadless(argc > 2 && argv[2][0] != '-' ? atol(argv[2]) : 10000000);
+        return 0;
+    }
+    if (argc > 2 && strcmp(argv[1], "--replay") == 0)
+        return runReplay(argv[2]);
+    if (argc > 1 && strcmp(argv[1], "--build-outcomes") == 0)
+        return buildOutcomes(argc > 2 && argv[2][0] != '-' ? argv[2] : outcomesPath);
+    if (argc > 1 && strcmp(argv[1], "--check-outcomes") == 0)
+        return checkOutcomes(argc > 2 && argv[2][0] != '-' ? argv[2] : outcomesPath);
+    if (argc > 1 && strcmp(argv[1], "--solve") == 0)
+        return runSolver(argc > 2 && argv[2][0] != '-' ? atoi(argv[2]) : 0);
+    if (argc > 1 && strcmp(argv[1], "--sweep") == 0)
+        return runSweep(argc > 2 && argv[2][0] != '-' ? argv[2] : "sweep.csv");
+    if (argc > 1 && strcmp(argv[1], "--bench-sweep") == 0) {
+        benchSweep();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-circles") == 0) {
+        printf("circle kernel: %s\n", CIRCLE_KERNEL_NAMES[circleKernel]);
+        benchCircles();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-collision") == 0) {
+        benchCollision();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-bricks") == 0) {
+        printf("brick kernel: %s\n", BRICK_KERNEL_NAMES[brickKernel]);
+        benchBricks();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-shots") == 0) {
+        benchShots();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-mirrors") == 0) {
+        benchMirrors();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-jobs") == 0) {
+        benchJobs();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-envs") == 0) {
+        benchEnvs();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "--bench-broadphase") == 0) {
+        benchBroadPhase();
+        return 0;
+    }
+
+    if (outcomes.open(outcomesPath, tickRate))
+        printf("aim assist: %s\n", outcomesPath);
+
     GLFWwindow* window = initGLFW(width, height);
 
 	initGL (window, width, height);
 
+  JobPool pool(sweepThreads);
+  jobs = &pool;
+  buildFrameGraph();
+
   double last_update_time = glfwGetTime(), current_time;
+  double last_stats_time = last_update_time;
 
-    /* Draw in loop */
-    while (!glfwWindowShouldClose(window)) {
+  // Fixed step simulation: frames feed real time in, ticks take it out in dt slices
+  const double dt = 1.0 / tickRate;
+  double accumulator = 0, last_frame_time = last_update_time;
+  if (deterministic)
+    printf("run %a %d\n", tickRate, (int)world.Collision);
+  previousState.capture(world);
 
-        // OpenGL Draw commands
-        draw();
+
+    /* Draw in loop; a win ends it like closing the window, so the job
+       pool's workers are idle and joined on the way out */
+    while (!glfwWindowShouldClose(window) && !world.Won) {
+
+        double frame_time = glfwGetTime();
+        accumulator += frame_time - last_frame_time;
+        last_frame_time = frame_time;
+
+        int ticks = 0;
+        while (accumulator >= dt && ticks < MAX_TICKS_PER_FRAME) {
+            accumulator -= dt;
+            ticks++;
+        }
+        if (accumulator >= dt)
+            accumulator = fmod(accumulator, dt);
+        frameTicks = ticks;
+        frameAlpha = accumulator / dt;
+        frameCharge = heldCharge();
+
+        int live_before = GLPool.LiveVertexArrays + GLPool.LiveBuffers;
+
+        // OpenGL Draw commands; batched, a big enough update runs on the
+        // job pool while this thread starts the frame's GL work
+        if (useBatch && frameOnPool()) {
+            jobs->start(frameGraph);
+            beginFrame();
+            jobs->wait();
+            endFrame();
+        }
+        else if (useBatch) {
+            beginFrame();
+            prepareFrame();
+            endFrame();
+        }
+        else {
+            simulateFrame();
+            draw(frameAlpha);
+        }
+
+        // A frame must hand back every GL object it creates
+        int live_after = GLPool.LiveVertexArrays + GLPool.LiveBuffers;
+        if (live_after != live_before)
+            fprintf(stderr, "GL leak: frame changed live objects by %d\n", live_after - live_before);
 
         // Swap Frame Buffer in double buffering
         glfwSwapBuffers(window);
@@ -1038,7 +2829,24 @@ int main (int argc, char** argv)
             // do something every 0.5 seconds ..
             last_update_time = current_time;
         }
+        if ((current_time - last_stats_time) >= 60) { // live GL objects should stay flat
+            printf("GL objects: %d VAOs (peak %d), %d buffers (peak %d), %ld bytes (peak %ld)\n",
+                   GLPool.LiveVertexArrays, GLPool.PeakVertexArrays, GLPool.LiveBuffers, GLPool.PeakBuffers,
+                   GLPool.LiveBytes, GLPool.PeakBytes);
+            printf("Batch: %d draws, %d vertices, %ld bytes streamed per frame\n",
+                   Batch.LastFrame.Draws, Batch.LastFrame.Vertices, Batch.LastFrame.Bytes);
+            printf("Circles: %d per frame in %d draws, %d vertices\n", Circles.LastCount, Circles.LastDraws, Circles.LastVertices);
+            printf("GL state calls: %d issued, %d elided per frame\n", GLState.LastIssued, GLState.LastElided);
+            printf("Camera block uploads: %d\n", Camera.Uploads);
+            printf("Frame tasks on %d workers:\n", jobs->workers());
+            frameGraph.dumpTimings(stdout);
+            last_stats_time = current_time;
+        }
     }
+    if (world.Won)
+        cout<<endl<<endl<<"YOU WON!!!  SCORE: "<<world.score<<endl;
+    reportRun();
+    releaseMeshes();
     glfwTerminate();
     //exit(EXIT_SUCCESS);
 }
@@ -0,0 +1,54 @@
+#include "bricks.h"
+
+BrickTable::BrickTable ()
+    : NextId(0)
+{
+}
+
+size_t BrickTable::add (float x, float y, float half, double rate)
+{
+    X.push_back(x);
+    Y.push_back(y);
+    Half.push_back(half);
+    Phase.push_back(0);
+    Rate.push_back(rate);
+    Alive.push_back(1);
+    Id.push_back(NextId++);
+    Row.push_back((int)X.size() - 1);
+    return X.size() - 1;
+}
+
+void BrickTable::remove (size_t i)
+{
+    size_t last = X.size() - 1;
+    Row[Id[last]] = (int)i;
+    Row[Id[i]] = -1;
+    X[i] = X[last];             X.pop_back();
+    Y[i] = Y[last];             Y.pop_back();
+    Half[i] = Half[last];       Half.pop_back();
+    Phase[i] = Phase[last];     Phase.pop_back();
+    Rate[i] = Rate[last];       Rate.pop_back();
+    Alive[i] = Alive[last];     Alive.pop_back();
+    Id[i] = Id[last];           Id.pop_back();
+}
+
+void BrickTable::compact ()
+{
+    // Walk down so a brick swapped in from the end has already been seen
+    for (size_t i = X.size(); i > 0; i--)
+        if (!Alive[i - 1])
+            remove(i - 1);
+}
+
+void BrickTable::clear ()
+{
+    X.clear();
+    Y.clear();
+    Half.clear();
+    Phase.clear();
+    Rate.clear();
+    Alive.clear();
+    Id.clear();
+    Row.clear();
+    NextId = 0;
+}
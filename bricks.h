@@ -0,0 +1,35 @@
+#ifndef BRICKS_H
+#define BRICKS_H
+
+#include <cstddef>
+#include <vector>
+
+/* Brick state as a struct of arrays, so the update and collision loops each
+   stream through only the columns they use. Index i of every column is the
+   same brick. A hit brick is first marked dead and later swept out by
+   compact(), which keeps indices still while a step walks them. Removing
+   moves the last brick into the hole, O(1), so order is not kept; Id is
+   what stays with a brick for its whole life. */
+struct BrickTable {
+    std::vector<float> X, Y;          // centre before falling
+    std::vector<float> Half;          // half the side
+    std::vector<double> Phase;        // the brick has fallen Phase^2 units
+    std::vector<double> Rate;         // Phase per second
+    std::vector<unsigned char> Alive;
+    std::vector<int> Id;              // in the order bricks were added
+    std::vector<int> Row;             // Id -> index, -1 once removed
+    int NextId;
+
+    BrickTable ();
+
+    size_t size () const { return X.size(); }
+    float y (size_t i) const { return Y[i] - (float)(Phase[i] * Phase[i]); }
+    int row (int id) const { return id >= 0 && id < NextId ? Row[id] : -1; }
+
+    size_t add (float x, float y, float half, double rate);
+    void remove (size_t i);
+    void compact ();                  // removes every brick not Alive
+    void clear ();
+};
+
+#endif
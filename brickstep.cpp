@@ -0,0 +1,161 @@
+#include <cmath>
+#include <cstring>
+
+#include "brickstep.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define HAVE_BRICK_SIMD 1
+#endif
+
+const char* const BRICK_KERNEL_NAMES[] = { "scalar", "sse4", "avx2" };
+
+// Squared reach that nothing passes when the step tests nothing
+static double reachSquared (const BrickStep& s)
+{
+    return s.Reach < 0 ? -1 : s.Reach * s.Reach;
+}
+
+// The SSE minpd/maxpd rules, so the scalar kernel matches them bit for bit
+static inline double minOf (double a, double b) { return a < b ? a : b; }
+static inline double maxOf (double a, double b) { return a > b ? a : b; }
+
+/* Also finishes whatever a SIMD kernel leaves over, from begin on */
+static void stepScalar (const BrickStep& s, size_t begin)
+{
+    double reach2 = reachSquared(s);
+    for (size_t i = begin; i < s.Count; i++) {
+        double p0 = s.Phase[i];
+        double p1 = p0 + s.Rate[i] * s.Dt;
+        double sq1 = p1 * p1;
+        bool wrap = sq1 >= s.Limit;
+        p1 = wrap ? 0 : p1;
+        sq1 = wrap ? 0 : sq1;
+        s.Phase[i] = p1;
+
+        // A wrapped brick jumped to the top; it doesn't sweep the gap
+        double sq0 = wrap ? sq1 : p0 * p0;
+        double h = s.Half[i] + s.Grow;
+        double y0 = s.Y[i] - sq0, y1 = s.Y[i] - sq1;
+        double lo = minOf(y0, y1) - h, hi = maxOf(y0, y1) + h;
+        double dx = maxOf(fabs(s.QueryX - s.X[i]) - h, 0);
+        double dy = maxOf(maxOf(lo - s.QueryY, s.QueryY - hi), 0);
+
+        s.Wrapped[i >> 6] |= (uint64_t)wrap << (i & 63);
+        s.Hits[i >> 6] |= (uint64_t)(dx*dx + dy*dy <= reach2) << (i & 63);
+    }
+}
+
+#if defined(HAVE_BRICK_SIMD)
+__attribute__((target("sse4.1")))
+static size_t stepSSE4 (const BrickStep& s)
+{
+    const __m128d dt = _mm_set1_pd(s.Dt), limit = _mm_set1_pd(s.Limit);
+    const __m128d qx = _mm_set1_pd(s.QueryX), qy = _mm_set1_pd(s.QueryY);
+    const __m128d reach2 = _mm_set1_pd(reachSquared(s));
+    const __m128d zero = _mm_setzero_pd(), sign = _mm_set1_pd(-0.0), grow = _mm_set1_pd(s.Grow);
+
+    size_t i = 0;
+    for (; i + 2 <= s.Count; i += 2) {
+        __m128d p0 = _mm_loadu_pd(s.Phase + i);
+        __m128d p1 = _mm_add_pd(p0, _mm_mul_pd(_mm_loadu_pd(s.Rate + i), dt));
+        __m128d sq1 = _mm_mul_pd(p1, p1);
+        __m128d wrap = _mm_cmpge_pd(sq1, limit);
+        p1 = _mm_andnot_pd(wrap, p1);
+        sq1 = _mm_andnot_pd(wrap, sq1);
+        _mm_storeu_pd(s.Phase + i, p1);
+
+        __m128d sq0 = _mm_blendv_pd(_mm_mul_pd(p0, p0), sq1, wrap);
+        __m128d x = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(s.X + i))));
+        __m128d y = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(s.Y + i))));
+        __m128d h = _mm_add_pd(_mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64((const __m128i*)(s.Half + i)))), grow);
+        __m128d y0 = _mm_sub_pd(y, sq0), y1 = _mm_sub_pd(y, sq1);
+        __m128d lo = _mm_sub_pd(_mm_min_pd(y0, y1), h), hi = _mm_add_pd(_mm_max_pd(y0, y1), h);
+        __m128d dx = _mm_max_pd(_mm_sub_pd(_mm_andnot_pd(sign, _mm_sub_pd(qx, x)), h), zero);
+        __m128d dy = _mm_max_pd(_mm_max_pd(_mm_sub_pd(lo, qy), _mm_sub_pd(qy, hi)), zero);
+        __m128d hit = _mm_cmple_pd(_mm_add_pd(_mm_mul_pd(dx, dx), _mm_mul_pd(dy, dy)), reach2);
+
+        s.Wrapped[i >> 6] |= (uint64_t)_mm_movemask_pd(wrap) << (i & 63);
+        s.Hits[i >> 6] |= (uint64_t)_mm_movemask_pd(hit) << (i & 63);
+    }
+    return i;
+}
+
+__attribute__((target("avx2")))
+static size_t stepAVX2 (const BrickStep& s)
+{
+    const __m256d dt = _mm256_set1_pd(s.Dt), limit = _mm256_set1_pd(s.Limit);
+    const __m256d qx = _mm256_set1_pd(s.QueryX), qy = _mm256_set1_pd(s.QueryY);
+    const __m256d reach2 = _mm256_set1_pd(reachSquared(s));
+    const __m256d zero = _mm256_setzero_pd(), sign = _mm256_set1_pd(-0.0), grow = _mm256_set1_pd(s.Grow);
+
+    size_t i = 0;
+    for (; i + 4 <= s.Count; i += 4) {
+        __m256d p0 = _mm256_loadu_pd(s.Phase + i);
+        __m256d p1 = _mm256_add_pd(p0, _mm256_mul_pd(_mm256_loadu_pd(s.Rate + i), dt));
+        __m256d sq1 = _mm256_mul_pd(p1, p1);
+        __m256d wrap = _mm256_cmp_pd(sq1, limit, _CMP_GE_OQ);
+        p1 = _mm256_andnot_pd(wrap, p1);
+        sq1 = _mm256_andnot_pd(wrap, sq1);
+        _mm256_storeu_pd(s.Phase + i, p1);
+
+        __m256d sq0 = _mm256_blendv_pd(_mm256_mul_pd(p0, p0), sq1, wrap);
+        __m256d x = _mm256_cvtps_pd(_mm_loadu_ps(s.X + i));
+        __m256d y = _mm256_cvtps_pd(_mm_loadu_ps(s.Y + i));
+        __m256d h = _mm256_add_pd(_mm256_cvtps_pd(_mm_loadu_ps(s.Half + i)), grow);
+        __m256d y0 = _mm256_sub_pd(y, sq0), y1 = _mm256_sub_pd(y, sq1);
+        __m256d lo = _mm256_sub_pd(_mm256_min_pd(y0, y1), h), hi = _mm256_add_pd(_mm256_max_pd(y0, y1), h);
+        __m256d dx = _mm256_max_pd(_mm256_sub_pd(_mm256_andnot_pd(sign, _mm256_sub_pd(qx, x)), h), zero);
+        __m256d dy = _mm256_max_pd(_mm256_max_pd(_mm256_sub_pd(lo, qy), _mm256_sub_pd(qy, hi)), zero);
+        __m256d hit = _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy)), reach2, _CMP_LE_OQ);
+
+        s.Wrapped[i >> 6] |= (uint64_t)_mm256_movemask_pd(wrap) << (i & 63);
+        s.Hits[i >> 6] |= (uint64_t)_mm256_movemask_pd(hit) << (i & 63);
+    }
+    return i;
+}
+#endif
+
+static BrickKernel detectBrickKernel ()
+{
+#if defined(HAVE_BRICK_SIMD)
+    if (__builtin_cpu_supports("avx2"))
+        return BRICK_KERNEL_AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return BRICK_KERNEL_SSE4;
+#endif
+    return BRICK_KERNEL_SCALAR;
+}
+
+BrickKernel brickKernel = detectBrickKernel();
+
+void stepBricks (const BrickStep& s, BrickKernel kernel)
+{
+    size_t words = (s.Count + 63) / 64;
+    memset(s.Wrapped, 0, words * sizeof(uint64_t));
+    memset(s.Hits, 0, words * sizeof(uint64_t));
+
+    size_t done = 0;
+    switch (kernel) {
+#if defined(HAVE_BRICK_SIMD)
+        case BRICK_KERNEL_AVX2:
+            done = stepAVX2(s);
+            break;
+        case BRICK_KERNEL_SSE4:
+            done = stepSSE4(s);
+            break;
+#endif
+        default:
+            break;
+    }
+    stepScalar(s, done);
+}
+
+size_t maskIndices (const uint64_t* mask, size_t count, unsigned* out)
+{
+    size_t n = 0;
+    for (size_t w = 0; w * 64 < count; w++)
+        for (uint64_t bits = mask[w]; bits; bits &= bits - 1)
+            out[n++] = (unsigned)(w * 64 + __builtin_ctzll(bits));
+    return n;
+}
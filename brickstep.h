@@ -0,0 +1,46 @@
+#ifndef BRICKSTEP_H
+#define BRICKSTEP_H
+
+#include <cstddef>
+#include <stdint.h>
+
+/* One step of falling for every brick in a BrickTable's columns, fused with
+   a test of each against a circle around the shot. The test is the broad
+   phase: it compares squared distances from the circle's centre to the box
+   each brick sweeps over the step, so it never misses and never takes a
+   sqrt. Results are bitmasks, bit i of word i/64 for brick i.
+
+   Every kernel gives bitwise the same phases and masks - there is no FMA -
+   so the choice of kernel never changes the game. */
+
+enum BrickKernel { BRICK_KERNEL_SCALAR, BRICK_KERNEL_SSE4, BRICK_KERNEL_AVX2 };
+extern const char* const BRICK_KERNEL_NAMES[];
+
+// Fastest kernel this CPU supports, picked once at start-up
+extern BrickKernel brickKernel;
+
+struct BrickStep {
+    const float* X;           // centre before falling
+    const float* Y;
+    const float* Half;        // half the side
+    double* Phase;            // advanced in place
+    const double* Rate;
+    size_t Count;
+    double Dt;
+    double Limit;             // a brick whose Phase^2 reaches this wraps to 0
+    // Bricks whose box over the step, each side pushed out by Grow, comes
+    // within Reach of (QueryX, QueryY) get their Hits bit; a negative Reach
+    // tests nothing
+    double Grow;
+    double QueryX, QueryY, Reach;
+    uint64_t* Wrapped;        // (Count + 63) / 64 words each, overwritten
+    uint64_t* Hits;
+};
+
+void stepBricks (const BrickStep& step, BrickKernel kernel = brickKernel);
+
+// Writes the index of every set bit among the first count to out, in order,
+// and returns how many there were
+size_t maskIndices (const uint64_t* mask, size_t count, unsigned* out);
+
+#endif
@@ -0,0 +1,150 @@
+#include <cmath>
+
+#include "collide.h"
+#include "toi.h"
+
+const char* const COLLISION_MODE_NAMES[] = { "planned", "swept", "conservative" };
+
+// Conservative advancement hands over to planContact after this many jumps;
+// only a shot grazing the box needs more than a handful
+const int ADVANCE_MAX_STEPS = 1000;
+
+static void keepFirst (double& first, double s)
+{
+    if (s >= 0 && (first < 0 || s < first))
+        first = s;
+}
+
+/* The rounded box is two crossed rectangles, one grown by r along x and one
+   along y, plus a circle of radius r on each corner. Each piece is entered
+   when a handful of polynomials in s all go non-negative. */
+double planContact (const ShotPath& shot, const BrickFall& brick, double r, double lo, double hi)
+{
+    // Shot relative to the box centre
+    double fall[2] = { brick.phase, brick.rate };
+    double drop[3];
+    polyMul(fall, 1, fall, 1, drop);
+    double dx[2] = { shot.x[0] - brick.cx, shot.x[1] };
+    double dy[3] = { shot.y[0] - brick.cy + drop[0], shot.y[1] + drop[1], shot.y[2] + drop[2] };
+    double h = brick.half;
+
+    double first = -1;
+    for (int axis = 0; axis < 2; axis++) {
+        double ex = h + (axis == 0 ? r : 0), ey = h + (axis == 1 ? r : 0);
+        double left[2] = { ex + dx[0], dx[1] }, right[2] = { ex - dx[0], -dx[1] };
+        double below[3] = { ey + dy[0], dy[1], dy[2] }, above[3] = { ey - dy[0], -dy[1], -dy[2] };
+        const double* c[4] = { left, right, below, above };
+        const int n[4] = { 1, 1, 2, 2 };
+        keepFirst(first, polyFirstInside(c, n, 4, lo, first >= 0 ? first : hi));
+    }
+
+    for (int corner = 0; corner < 4; corner++) {
+        double ox[2] = { dx[0] - (corner & 1 ? h : -h), dx[1] };
+        double oy[3] = { dy[0] - (corner & 2 ? h : -h), dy[1], dy[2] };
+        double gap[5], gy[5];
+        polyMul(ox, 1, ox, 1, gap);
+        gap[3] = gap[4] = 0;
+        polyMul(oy, 2, oy, 2, gy);
+        for (int k = 0; k < 5; k++)
+            gap[k] = -(gap[k] + gy[k]);
+        gap[0] += r * r;
+        const double* c[1] = { gap };
+        const int n[1] = { 4 };
+        keepFirst(first, polyFirstInside(c, n, 1, lo, first >= 0 ? first : hi));
+    }
+    return first;
+}
+
+// First t in [0, 1] with a + t*d inside |x| <= ex, |y| <= ey, or -1
+static double segmentBox (double ax, double ay, double dx, double dy, double ex, double ey)
+{
+    double enter = 0, leave = 1;
+    const double a[2] = { ax, ay }, d[2] = { dx, dy }, e[2] = { ex, ey };
+    for (int i = 0; i < 2; i++) {
+        if (d[i] == 0) {
+            if (fabs(a[i]) > e[i])
+                return -1;
+            continue;
+        }
+        double t0 = (-e[i] - a[i]) / d[i], t1 = (e[i] - a[i]) / d[i];
+        if (t0 > t1) {
+            double tmp = t0; t0 = t1; t1 = tmp;
+        }
+        enter = fmax(enter, t0);
+        leave = fmin(leave, t1);
+        if (enter > leave)
+            return -1;
+    }
+    return enter;
+}
+
+// First t in [0, 1] with a + t*d within r of (cx, cy), or -1
+static double segmentCircle (double ax, double ay, double dx, double dy, double cx, double cy, double r)
+{
+    double ox = ax - cx, oy = ay - cy;
+    double c = ox*ox + oy*oy - r*r;
+    if (c <= 0)
+        return 0;
+    double a = dx*dx + dy*dy, b = ox*dx + oy*dy;
+    if (a == 0 || b >= 0)
+        return -1;
+    double disc = b*b - a*c;
+    if (disc < 0)
+        return -1;
+    double t = (-b - sqrt(disc)) / a;
+    return t <= 1 ? t : -1;
+}
+
+/* In the box's frame the shot moves from its start relative to the first box
+   to its end relative to the second, which is a plain segment against a
+   still rounded box. */
+double sweptContact (double x0, double y0, double x1, double y1, double r,
+                     const HitBox& from, const HitBox& to)
+{
+    double ax = x0 - from.cx, ay = y0 - from.cy;
+    double dx = x1 - to.cx - ax, dy = y1 - to.cy - ay;
+    double h = from.half;
+
+    double first = -1;
+    keepFirst(first, segmentBox(ax, ay, dx, dy, h + r, h));
+    keepFirst(first, segmentBox(ax, ay, dx, dy, h, h + r));
+    for (int corner = 0; corner < 4; corner++)
+        keepFirst(first, segmentCircle(ax, ay, dx, dy, corner & 1 ? h : -h, corner & 2 ? h : -h, r));
+    return first;
+}
+
+static double boxGap (const ShotPath& shot, const BrickFall& brick, double r, double s)
+{
+    double phase = brick.phase + brick.rate * s;
+    double ox = fabs(polyEval(shot.x, 1, s) - brick.cx) - brick.half;
+    double oy = fabs(polyEval(shot.y, 2, s) - (brick.cy - phase*phase)) - brick.half;
+    ox = fmax(ox, 0);
+    oy = fmax(oy, 0);
+    return sqrt(ox*ox + oy*oy) - r;
+}
+
+/* Both velocities are linear in s, so over [lo, hi] their sizes peak at an
+   end; the sum of the peaks bounds how fast the gap can close, and jumping
+   ahead by gap / bound can never step past a contact. */
+double advanceContact (const ShotPath& shot, const BrickFall& brick, double r,
+                       double lo, double hi, double tolerance)
+{
+    double vx = shot.x[1];
+    double vy = fmax(fabs(shot.y[1] + 2*shot.y[2]*lo), fabs(shot.y[1] + 2*shot.y[2]*hi));
+    double vb = 2 * fabs(brick.rate) * fmax(fabs(brick.phase + brick.rate*lo), fabs(brick.phase + brick.rate*hi));
+    double closing = sqrt(vx*vx + vy*vy) + vb;
+
+    double s = lo;
+    for (int i = 0; i < ADVANCE_MAX_STEPS; i++) {
+        double gap = boxGap(shot, brick, r, s);
+        if (gap <= tolerance)
+            return s;
+        if (closing <= 0)
+            return -1;
+        s += gap / closing;
+        if (s > hi)
+            return -1;
+    }
+    // Still short of a contact, so the rest of the window is solved exactly
+    return planContact(shot, brick, r, s, hi);
+}
@@ -0,0 +1,57 @@
+#ifndef COLLIDE_H
+#define COLLIDE_H
+
+/* Shot vs brick contact. The shot is a circle and a brick's hit box an axis
+   aligned square, both moving; they touch when the shot's centre enters the
+   box grown by the shot radius with rounded corners. Three ways of finding
+   that, all of which hit at any shot speed:
+
+     COLLIDE_PLANNED       exact first contact along the real curved paths,
+                           solved once per path (see toi.h)
+     COLLIDE_SWEPT         each step, the segment the shot moved along against
+                           the box moving between its two positions
+     COLLIDE_CONSERVATIVE  each step, conservative advancement along the real
+                           paths: jump ahead by gap / top closing speed until
+                           the gap is under a tolerance */
+
+enum CollisionMode {
+    COLLIDE_PLANNED,
+    COLLIDE_SWEPT,
+    COLLIDE_CONSERVATIVE
+};
+
+extern const char* const COLLISION_MODE_NAMES[];
+
+// Conservative advancement counts a hit this close to touching
+const double ADVANCE_TOLERANCE = 1e-3;
+
+// Shot centre as polynomials in s seconds: x[0] + x[1]s, y[0] + y[1]s + y[2]s^2
+struct ShotPath {
+    double x[2], y[3];
+};
+
+// A falling hit box: centre (cx, cy - phase^2) with phase = phase + rate*s
+struct BrickFall {
+    double cx, cy, half;
+    double phase, rate;
+};
+
+struct HitBox {
+    double cx, cy, half;
+};
+
+// First s in [lo, hi] the shot of radius r touches the brick, or -1
+double planContact (const ShotPath& shot, const BrickFall& brick, double r, double lo, double hi);
+
+// First fraction in [0, 1] of a step at which a shot of radius r moving
+// straight from (x0, y0) to (x1, y1) touches a box moving straight from
+// from to to, or -1
+double sweptContact (double x0, double y0, double x1, double y1, double r,
+                     const HitBox& from, const HitBox& to);
+
+// First s in [lo, hi] the shot comes within tolerance of touching the brick, or -1;
+// should the jumps run out first, planContact finds it from there exactly
+double advanceContact (const ShotPath& shot, const BrickFall& brick, double r,
+                       double lo, double hi, double tolerance);
+
+#endif
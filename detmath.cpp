@@ -0,0 +1,65 @@
+#include <cmath>
+
+#include "detmath.h"
+
+// pi/2 split so n * PIO2_HI is exact for the n the game ever sees
+static const double PIO2_HI = 1.57079632673412561417e+00;
+static const double PIO2_LO = 6.07710050650619224932e-11;
+static const double TWO_OVER_PI = 6.36619772367581382433e-01;
+
+// Minimax polynomials for sin and cos on [-pi/4, pi/4], from fdlibm
+static double kernelSin (double x)
+{
+    const double S1 = -1.66666666666666324348e-01, S2 = 8.33333333332248946124e-03,
+                 S3 = -1.98412698298579493134e-04, S4 = 2.75573137070700676789e-06,
+                 S5 = -2.50507602534068634195e-08, S6 = 1.58969099521155010221e-10;
+    double z = x*x;
+    return x + x*z*(S1 + z*(S2 + z*(S3 + z*(S4 + z*(S5 + z*S6)))));
+}
+
+static double kernelCos (double x)
+{
+    const double C1 = 4.16666666666666019037e-02, C2 = -1.38888888888741095749e-03,
+                 C3 = 2.48015872894767294178e-05, C4 = -2.75573143513906633035e-07,
+                 C5 = 2.08757232129817482790e-09, C6 = -1.13596475577881948265e-11;
+    double z = x*x;
+    return 1 - 0.5*z + z*z*(C1 + z*(C2 + z*(C3 + z*(C4 + z*(C5 + z*C6)))));
+}
+
+// x - n pi/2 for the nearest n, and n mod 4
+static double reduce (double x, int& quadrant)
+{
+    double n = floor(x*TWO_OVER_PI + 0.5);
+    quadrant = (int)(n - 4*floor(n/4));
+    return (x - n*PIO2_HI) - n*PIO2_LO;
+}
+
+double detSin (double x)
+{
+    int q;
+    double r = reduce(x, q);
+    switch (q) {
+        case 0: return kernelSin(r);
+        case 1: return kernelCos(r);
+        case 2: return -kernelSin(r);
+        default: return -kernelCos(r);
+    }
+}
+
+double detCos (double x)
+{
+    int q;
+    double r = reduce(x, q);
+    switch (q) {
+        case 0: return kernelCos(r);
+        case 1: return -kernelSin(r);
+        case 2: return -kernelCos(r);
+        default: return kernelSin(r);
+    }
+}
+
+double detHypot (double x, double y)
+{
+    // Game distances never come near overflow, so no scaling
+    return sqrt(x*x + y*y);
+}
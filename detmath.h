@@ -0,0 +1,23 @@
+#ifndef DETMATH_H
+#define DETMATH_H
+
+#include <cfloat>
+
+/* The few transcendental functions the simulation needs, built from +, -,
+   *, / and sqrt only. IEEE 754 rounds each of those exactly, so unlike libm
+   these give the same bits on every machine and compiler. With the
+   simulation compiled -ffp-contract=off (see the Makefile), so nothing is
+   fused into an FMA, the same inputs step to bit-identical worlds. */
+
+#if defined(__FAST_MATH__)
+#error "the simulation must be built without -ffast-math to stay deterministic"
+#endif
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0
+#error "the simulation needs float and double kept at their own precision (SSE2, not x87)"
+#endif
+
+double detSin (double x);
+double detCos (double x);
+double detHypot (double x, double y);
+
+#endif
@@ -0,0 +1,184 @@
+#include <vector>
+
+#include "envbatch.h"
+#include "world.h"
+
+static_assert((int)ENVBATCH_AIM_UP == (int)AIM_UP && (int)ENVBATCH_FIRE == (int)FIRE,
+              "actions must match WorldAction");
+static_assert((int)ENVBATCH_COLLIDE_PLANNED == (int)COLLIDE_PLANNED &&
+              (int)ENVBATCH_COLLIDE_CONSERVATIVE == (int)COLLIDE_CONSERVATIVE,
+              "collision modes must match CollisionMode");
+
+struct EnvBatch {
+    std::vector<World> Worlds;
+    double Dt;
+    int TicksPerStep;
+    long MaxTicks;
+
+    // Storage behind Buffers, sized once
+    std::vector<float> Basket1, Basket2, Angle, Reward;
+    std::vector<int32_t> Score, ShotCount;
+    std::vector<int64_t> Ticks;
+    std::vector<uint8_t> Done, BrickAlive;
+    std::vector<float> ShotX, ShotY, ShotVx, ShotVy;
+    std::vector<float> BrickX, BrickY;
+    EnvBatchBuffers Buffers;
+
+    void size (int maxShots);
+    bool step (int e, int32_t action, float charge);
+    void observe (int e);
+};
+
+// Writes game e's columns
+void EnvBatch::observe (int e)
+{
+    const World& w = Worlds[e];
+    Basket1[e] = w.x;
+    Basket2[e] = w.X;
+    Angle[e] = w.rot_ang;
+    Score[e] = w.score;
+    Ticks[e] = w.Ticks;
+
+    // The pool holds max_shots, so every shot fits
+    int shots = (int)w.Shots.size();
+    ShotCount[e] = shots;
+    size_t base = (size_t)e * Buffers.max_shots;
+    for (int k = 0; k < shots; k++) {
+        const Shot& s = w.Shots.Active[k];
+        ShotPath path = w.shotPath(s);
+        ShotX[base + k] = s.x();
+        ShotY[base + k] = s.y();
+        ShotVx[base + k] = (float)path.x[1];
+        ShotVy[base + k] = (float)path.y[1];
+    }
+
+    // A brick gone from the table keeps the place it was last seen
+    base = (size_t)e * Buffers.max_bricks;
+    for (int id = 0; id < Buffers.max_bricks; id++) {
+        int i = w.Bricks.row(id);
+        if (i >= 0) {
+            BrickX[base + id] = w.Bricks.X[i];
+            BrickY[base + id] = w.Bricks.y(i);
+        }
+        BrickAlive[base + id] = i >= 0 && w.Bricks.Alive[i];
+    }
+}
+
+// Allocates the columns and points Buffers at them
+void EnvBatch::size (int maxShots)
+{
+    size_t n = Worlds.size();
+    int bricks = Worlds[0].Bricks.NextId;
+    Basket1.resize(n); Basket2.resize(n); Angle.resize(n); Reward.resize(n);
+    Score.resize(n); ShotCount.resize(n); Ticks.resize(n); Done.resize(n);
+    ShotX.resize(n * maxShots); ShotY.resize(n * maxShots);
+    ShotVx.resize(n * maxShots); ShotVy.resize(n * maxShots);
+    BrickX.resize(n * bricks); BrickY.resize(n * bricks); BrickAlive.resize(n * bricks);
+
+    EnvBatchBuffers& o = Buffers;
+    o.num_envs = (int)n;
+    o.max_shots = maxShots;
+    o.max_bricks = bricks;
+    o.basket1_x = Basket1.data();
+    o.basket2_x = Basket2.data();
+    o.rot_ang = Angle.data();
+    o.score = Score.data();
+    o.ticks = Ticks.data();
+    o.reward = Reward.data();
+    o.done = Done.data();
+    o.shot_count = ShotCount.data();
+    o.shot_x = ShotX.data();
+    o.shot_y = ShotY.data();
+    o.shot_vx = ShotVx.data();
+    o.shot_vy = ShotVy.data();
+    o.brick_x = BrickX.data();
+    o.brick_y = BrickY.data();
+    o.brick_alive = BrickAlive.data();
+}
+
+// Steps game e and writes its columns; true if it finished
+bool EnvBatch::step (int e, int32_t action, float charge)
+{
+    World& w = Worlds[e];
+    int before = w.score;
+    if (action >= ENVBATCH_AIM_UP && action < ENVBATCH_NOOP) {
+        WorldInput input = { (WorldAction)action, action == ENVBATCH_FIRE ? charge : 0 };
+        w.apply(input);
+    }
+    for (int t = 0; t < TicksPerStep && !w.Won; t++)
+        w.step(Dt);
+
+    Reward[e] = (float)(w.score - before);
+    bool done = w.Won || w.Ticks >= MaxTicks;
+    Done[e] = done;
+    if (done) {
+        // reset() reuses every vector the game already has, so this
+        // doesn't allocate either
+        w.reset();
+    }
+    observe(e);
+    return done;
+}
+
+EnvBatch* envbatch_create (int num_envs, int max_shots, double tick_rate, int collision,
+                           int ticks_per_step, int64_t max_ticks)
+{
+    if (num_envs <= 0 || max_shots < 1 || !(tick_rate > 0) || collision < ENVBATCH_COLLIDE_PLANNED ||
+        collision > ENVBATCH_COLLIDE_CONSERVATIVE || ticks_per_step < 1 || max_ticks < 1)
+        return NULL;
+
+    // Nothing may throw out through the C interface
+    EnvBatch* b = NULL;
+    try {
+        b = new EnvBatch;
+        b->Worlds.reserve(num_envs);
+        for (int e = 0; e < num_envs; e++) {
+            // Built in place, with room for max_shots shots
+            b->Worlds.emplace_back(max_shots);
+            b->Worlds[e].Collision = (CollisionMode)collision;
+        }
+        b->size(max_shots);
+        b->Dt = 1.0 / tick_rate;
+        b->TicksPerStep = ticks_per_step;
+        b->MaxTicks = (long)max_ticks;
+        envbatch_reset(b);
+    }
+    catch (...) {
+        delete b;
+        return NULL;
+    }
+    return b;
+}
+
+void envbatch_destroy (EnvBatch* batch)
+{
+    delete batch;
+}
+
+const EnvBatchBuffers* envbatch_buffers (const EnvBatch* batch)
+{
+    return &batch->Buffers;
+}
+
+void envbatch_reset (EnvBatch* batch)
+{
+    for (int e = 0; e < batch->Buffers.num_envs; e++) {
+        batch->Worlds[e].reset();
+        batch->Reward[e] = 0;
+        batch->Done[e] = 0;
+        batch->observe(e);
+    }
+}
+
+int envbatch_step (EnvBatch* batch, const int32_t* actions, const float* charges)
+{
+    int finished = 0;
+    try {
+        for (int e = 0; e < batch->Buffers.num_envs; e++)
+            finished += batch->step(e, actions ? actions[e] : ENVBATCH_NOOP, charges ? charges[e] : 0);
+    }
+    catch (...) {
+        return -1;
+    }
+    return finished;
+}
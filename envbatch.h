@@ -0,0 +1,102 @@
+#ifndef ENVBATCH_H
+#define ENVBATCH_H
+
+#include <stdint.h>
+
+/* Many games stepped together, for training agents, with a C interface
+   (libenvbatch.so) so they can be driven from any language. Each step
+   takes an action per game and writes what every game looks like after it
+   into flat arrays, one per field, that the batch allocates once: the
+   pointers in envbatch_buffers() stay good until envbatch_destroy() and
+   stepping never allocates. A game that finishes - every brick hit and no
+   shot left, or out of ticks - is started again within the same step:
+   its done flag is set, reward is its last, and its observation is the new
+   game's. Batches share nothing, so separate ones can be stepped on
+   separate threads. */
+
+/* libenvbatch.so is built with hidden visibility; only these are exported */
+#if defined(__GNUC__)
+#define ENVBATCH_API __attribute__((visibility("default")))
+#else
+#define ENVBATCH_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Actions, the same as WorldAction; anything else does nothing */
+enum {
+    ENVBATCH_AIM_UP,
+    ENVBATCH_AIM_DOWN,
+    ENVBATCH_BASKET1_LEFT,
+    ENVBATCH_BASKET1_RIGHT,
+    ENVBATCH_BASKET2_LEFT,
+    ENVBATCH_BASKET2_RIGHT,
+    ENVBATCH_FIRE,
+    ENVBATCH_NOOP
+};
+
+/* Collision modes, the same as CollisionMode */
+enum {
+    ENVBATCH_COLLIDE_PLANNED,
+    ENVBATCH_COLLIDE_SWEPT,
+    ENVBATCH_COLLIDE_CONSERVATIVE
+};
+
+typedef struct EnvBatch EnvBatch;
+
+/* Environment e's value of a per-game field is [e]; of a per-shot or
+   per-brick field, [e * max_shots + k] or [e * max_bricks + k] */
+typedef struct {
+    int num_envs, max_shots, max_bricks;
+
+    /* Per game */
+    float* basket1_x;         /* x, moved with right ctrl */
+    float* basket2_x;         /* X, moved with right alt */
+    float* rot_ang;           /* cannon angle in degrees */
+    int32_t* score;
+    int64_t* ticks;           /* into this game */
+    float* reward;            /* score gained in the last step */
+    uint8_t* done;            /* the last step finished the game */
+
+    /* Shots in flight, the first shot_count[e] of each game's max_shots;
+       velocities are in units per second */
+    int32_t* shot_count;
+    float* shot_x;
+    float* shot_y;
+    float* shot_vx;
+    float* shot_vy;
+
+    /* Bricks by the order the level adds them; a hit one stays put with
+       alive 0 */
+    float* brick_x;
+    float* brick_y;
+    uint8_t* brick_alive;
+} EnvBatchBuffers;
+
+/* Each game has room for max_shots shots in flight, and firing with that
+   many out does nothing; collision is an ENVBATCH_COLLIDE_ mode; each step advances
+   every game ticks_per_step ticks of 1/tick_rate s, and a game gives up
+   after max_ticks. NULL if an argument is out of range or there isn't the
+   memory. */
+ENVBATCH_API EnvBatch* envbatch_create (int num_envs, int max_shots, double tick_rate, int collision,
+                                        int ticks_per_step, int64_t max_ticks);
+ENVBATCH_API void envbatch_destroy (EnvBatch* batch);
+
+ENVBATCH_API const EnvBatchBuffers* envbatch_buffers (const EnvBatch* batch);
+
+/* Starts every game again */
+ENVBATCH_API void envbatch_reset (EnvBatch* batch);
+
+/* One action per game, and for ENVBATCH_FIRE the seconds the fire key was
+   held (charges may be NULL when nothing fires); returns how many games
+   finished. The first step sizes each game's scratch space; if that or
+   anything else fails it returns -1 and the batch can only be destroyed. */
+ENVBATCH_API int envbatch_step (EnvBatch* batch, const int32_t* actions, const float* charges);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,153 @@
+#include <cmath>
+
+#include "mirrors.h"
+#include "detmath.h"
+#include "toi.h"
+
+// A root this close after a bounce is the mirror just left, not a new crossing
+const double MIRROR_SLACK = 1e-9;
+// Long flights are looked up in the grid this many seconds at a time, so
+// each query covers a few cells rather than the whole arc
+const double MIRROR_WINDOW = 0.1;
+
+MirrorSet::MirrorSet ()
+    : Built(true)
+{
+}
+
+size_t MirrorSet::add (double ax, double ay, double bx, double by)
+{
+    double length = detHypot(bx - ax, by - ay);
+    double dx = (bx - ax) / length, dy = (by - ay) / length;
+    Mirror m = { ax, ay, bx, by, dx, dy, -dy, dx, length };
+    Segments.push_back(m);
+    Built = false;
+    return Segments.size() - 1;
+}
+
+void MirrorSet::clear ()
+{
+    Segments.clear();
+    Built = false;
+}
+
+// Box around the path from lo to hi, as minX, minY, maxX, maxY
+static void pathBox (const ShotPath& path, double lo, double hi, double* box)
+{
+    double x0 = polyEval(path.x, 1, lo), x1 = polyEval(path.x, 1, hi);
+    double y0 = polyEval(path.y, 2, lo), y1 = polyEval(path.y, 2, hi);
+    box[0] = fmin(x0, x1);
+    box[1] = fmin(y0, y1);
+    box[2] = fmax(x0, x1);
+    box[3] = fmax(y0, y1);
+    double apex = -path.y[1] / (2*path.y[2]);
+    if (apex > lo && apex < hi)
+        box[3] = fmax(box[3], polyEval(path.y, 2, apex));
+}
+
+void MirrorSet::prepare ()
+{
+    size_t count = Segments.size();
+    if (Built || count < MIRROR_GRID_MIN)
+        return;
+    Grid.clear();
+    for (size_t m = 0; m < count; m++) {
+        const Mirror& s = Segments[m];
+        Grid.insert((int)m, fmin(s.AX, s.BX), fmin(s.AY, s.BY), fmax(s.AX, s.BX), fmax(s.AY, s.BY));
+    }
+    Grid.build();
+    Built = true;
+}
+
+int MirrorSet::firstHit (const ShotPath& path, double lo, double hi, int skip, double& when)
+{
+    prepare();
+    return firstHit(path, lo, hi, skip, when, Near);
+}
+
+int MirrorSet::firstHit (const ShotPath& path, double lo, double hi, int skip, double& when,
+                         SpatialScratch& near) const
+{
+    size_t count = Segments.size();
+    if (count == 0 || lo > hi)
+        return -1;
+
+    double box[4];
+    if (count < MIRROR_GRID_MIN) {
+        near.Found.clear();
+        for (size_t m = 0; m < count; m++)
+            near.Found.push_back((int)m);
+        pathBox(path, lo, hi, box);
+        return crossing(path, lo, hi, box, skip, lo + MIRROR_SLACK, when, near.Found);
+    }
+
+    for (double a = lo; a <= hi; a += MIRROR_WINDOW) {
+        double b = fmin(a + MIRROR_WINDOW, hi);
+        pathBox(path, a, b, box);
+        near.Found.clear();
+        Grid.query(box[0], box[1], box[2], box[3], near);
+        int hit = crossing(path, a, b, box, skip, lo + MIRROR_SLACK, when, near.Found);
+        if (hit >= 0 || b >= hi)
+            return hit;
+    }
+    return -1;
+}
+
+// First crossing in [lo, hi] of a mirror in near that meets box, not
+// counting skip's up to until
+int MirrorSet::crossing (const ShotPath& path, double lo, double hi, const double* box,
+                         int skip, double until, double& when, const std::vector<int>& near) const
+{
+    int hit = -1;
+    when = hi;
+    for (size_t k = 0; k < near.size(); k++) {
+        const Mirror& s = Segments[near[k]];
+        if (fmax(s.AX, s.BX) < box[0] || fmin(s.AX, s.BX) > box[2] ||
+            fmax(s.AY, s.BY) < box[1] || fmin(s.AY, s.BY) > box[3])
+            continue;
+        // Distance from the mirror's line along its normal
+        double d[3] = { s.NX*(path.x[0] - s.AX) + s.NY*(path.y[0] - s.AY),
+                        s.NX*path.x[1] + s.NY*path.y[1],
+                        s.NY*path.y[2] };
+        // No root unless the ends or the turning point between them differ in sign
+        double a = polyEval(d, 2, lo), b = polyEval(d, 2, when);
+        double turn = d[2] != 0 ? -d[1] / (2*d[2]) : lo;
+        double c = turn > lo && turn < when ? polyEval(d, 2, turn) : a;
+        if ((a > 0 && b > 0 && c > 0) || (a < 0 && b < 0 && c < 0))
+            continue;
+        double roots[3];
+        int found = polyRoots(d, 2, lo, when, roots);
+        for (int r = 0; r < found; r++) {
+            if (near[k] == skip && roots[r] <= until)
+                continue;
+            double px = polyEval(path.x, 1, roots[r]), py = polyEval(path.y, 2, roots[r]);
+            double along = s.DX*(px - s.AX) + s.DY*(py - s.AY);
+            if (along >= 0 && along <= s.Length) {
+                hit = near[k];
+                when = roots[r];
+                break;
+            }
+        }
+    }
+    return hit;
+}
+
+void MirrorSet::turn (int m, double& vx, double& vy) const
+{
+    const Mirror& s = Segments[m];
+    double dot = vx*s.NX + vy*s.NY;
+    vx -= 2*dot*s.NX;
+    vy -= 2*dot*s.NY;
+}
+
+ShotPath MirrorSet::reflect (const ShotPath& path, int m, double s) const
+{
+    // Same point and gravity, velocity turned about the normal
+    double px = polyEval(path.x, 1, s), py = polyEval(path.y, 2, s);
+    double vx = path.x[1], vy = path.y[1] + 2*path.y[2]*s;
+    turn(m, vx, vy);
+    double g = path.y[2];
+    ShotPath turned = { { px - vx*s, vx },
+                        { py - vy*s + g*s*s, vy - 2*g*s, g } };
+    return turned;
+}
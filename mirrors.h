@@ -0,0 +1,60 @@
+#ifndef MIRRORS_H
+#define MIRRORS_H
+
+#include <cstddef>
+#include <vector>
+
+#include "collide.h"
+#include "spatial.h"
+
+/* Mirror segments that shots bounce off, from either side. A shot reflects
+   where its centre crosses a segment: along the segment's normal its path
+   is a quadratic in time, so the crossing is that quadratic's first root
+   whose point lies between the ends. With many mirrors they go in a grid,
+   built once after they change, and a query only looks at those near the
+   box the shot moves through. */
+
+// Fewer mirrors than this are each checked; the grid costs more than it saves
+const size_t MIRROR_GRID_MIN = 16;
+
+struct Mirror {
+    double AX, AY, BX, BY;    // ends
+    double DX, DY;            // unit direction from A to B
+    double NX, NY;            // unit normal
+    double Length;
+};
+
+struct MirrorSet {
+    MirrorSet ();
+
+    std::vector<Mirror> Segments;
+
+    size_t size () const { return Segments.size(); }
+    size_t add (double ax, double ay, double bx, double by);
+    void clear ();
+
+    // First mirror the path crosses in (lo, hi], with when set to the time,
+    // or -1. A crossing of skip at lo (it just bounced off that one) is not
+    // a new one.
+    int firstHit (const ShotPath& path, double lo, double hi, int skip, double& when);
+    // The same with the caller's scratch, for threads to share the set; only
+    // once prepare() has built the grid for the segments as they are
+    int firstHit (const ShotPath& path, double lo, double hi, int skip, double& when,
+                  SpatialScratch& near) const;
+    void prepare ();
+
+    // A velocity after bouncing off mirror m
+    void turn (int m, double& vx, double& vy) const;
+    // The path from s on, reflected in mirror m at time s
+    ShotPath reflect (const ShotPath& path, int m, double s) const;
+
+private:
+    int crossing (const ShotPath& path, double lo, double hi, const double* box,
+                  int skip, double until, double& when, const std::vector<int>& near) const;
+
+    SpatialHash Grid;
+    bool Built;               // the grid has every segment
+    SpatialScratch Near;
+};
+
+#endif
@@ -0,0 +1,192 @@
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "outcomes.h"
+
+static const char MAGIC[8] = { 'S', 'H', 'O', 'T', 'O', 'U', 'T', '1' };
+static const int ANGLES = 21;
+
+OutcomeTable::OutcomeTable ()
+    : Map(NULL), Bytes(0), Header(NULL), Entries(NULL)
+{
+}
+
+OutcomeTable::~OutcomeTable ()
+{
+    close();
+}
+
+bool OutcomeTable::open (const char* path, double tickRate)
+{
+    close();
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    struct stat st;
+    void* map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(OutcomeHeader))
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    Map = map;
+    Bytes = st.st_size;
+
+    // Only a table for this very level and step is any use
+    const OutcomeHeader* h = (const OutcomeHeader*)Map;
+    World level;
+    size_t entries = 0;
+    bool ok = memcmp(h->Magic, MAGIC, sizeof MAGIC) == 0 && h->Level == level.hash() &&
+              h->TickRate == tickRate && h->Angles == ANGLES && h->Charges > 0 &&
+              h->Bricks == WORLD_BRICKS;
+    for (int b = 0; ok && b < WORLD_BRICKS; b++) {
+        Start[b] = entries;
+        ok = h->Period[b] > 0;
+        entries += (size_t)h->Period[b] * h->Angles * h->Charges;
+    }
+    if (!ok || Bytes != sizeof(OutcomeHeader) + entries * sizeof(uint16_t)) {
+        close();
+        return false;
+    }
+    Header = h;
+    Entries = (const uint16_t*)(h + 1);
+    return true;
+}
+
+void OutcomeTable::close ()
+{
+    if (Map)
+        munmap(Map, Bytes);
+    Map = NULL;
+    Bytes = 0;
+    Header = NULL;
+    Entries = NULL;
+}
+
+int OutcomeTable::predict (const World& w, double charge, long& ticks) const
+{
+    if (!Header)
+        return -1;
+    long c = lround(charge * Header->TickRate);
+    int a = (int)lround((w.rot_ang + 50) / 5);
+    if (c < 0 || c >= Header->Charges || a < 0 || a >= Header->Angles)
+        return -1;
+
+    double dt = 1.0 / Header->TickRate;
+    int first = -1;
+    for (int b = 0; b < Header->Bricks; b++) {
+        int i = w.Bricks.row(b);
+        if (i < 0 || !w.Bricks.Alive[i])
+            continue;
+        // Every wrap puts the phase back to 0, so it counts ticks into the cycle
+        long k = lround(w.Bricks.Phase[i] / (w.Bricks.Rate[i] * dt));
+        if (k < 0 || k >= Header->Period[b])
+            continue;
+        uint16_t hit = Entries[Start[b] + ((size_t)k * Header->Angles + a) * Header->Charges + c];
+        if (hit != OUTCOME_MISS && (first < 0 || hit < ticks)) {
+            first = b;
+            ticks = hit;
+        }
+    }
+    return first;
+}
+
+// Brick b of the fresh level on its own, k ticks into its fall
+static void alone (World& w, int b, long k, double dt)
+{
+    for (size_t i = w.Bricks.size(); i > 0; i--)
+        if (w.Bricks.Id[i - 1] != b)
+            w.Bricks.remove(i - 1);
+    for (long t = 0; t < k; t++)
+        w.step(dt);
+}
+
+size_t buildOutcomeTable (const char* path, double tickRate, double maxCharge, int threads,
+                          ParallelStats* stats)
+{
+    const double dt = 1.0 / tickRate;
+    OutcomeHeader h;
+    memset(&h, 0, sizeof h);
+    memcpy(h.Magic, MAGIC, sizeof MAGIC);
+    World level;
+    h.Level = level.hash();
+    h.TickRate = tickRate;
+    h.Angles = ANGLES;
+    h.Charges = (int32_t)floor(maxCharge * tickRate) + 1;
+    h.Bricks = WORLD_BRICKS;
+
+    // Step the bare level until every brick has wrapped once
+    World w;
+    for (int found = 0; found < WORLD_BRICKS && w.Ticks < 1000000; ) {
+        w.step(dt);
+        for (int b = 0; b < WORLD_BRICKS; b++)
+            if (h.Period[b] == 0 && w.Bricks.Phase[w.Bricks.row(b)] == 0) {
+                h.Period[b] = (int32_t)w.Ticks;
+                found++;
+            }
+    }
+
+    // A unit of work is one brick at one cycle tick, all angles and charges
+    std::vector<int> unitBrick;
+    std::vector<long> unitTick;
+    for (int b = 0; b < WORLD_BRICKS; b++)
+        for (long k = 0; k < h.Period[b]; k++) {
+            unitBrick.push_back(b);
+            unitTick.push_back(k);
+        }
+    const size_t perUnit = (size_t)h.Angles * h.Charges;
+    std::vector<uint16_t> entries(unitBrick.size() * perUnit);
+
+    ParallelStats ran = parallelFor(unitBrick.size(), threads, [&] (size_t u, int) {
+        World base;
+        alone(base, unitBrick[u], unitTick[u], dt);
+        World w = base;
+        uint16_t* out = &entries[u * perUnit];
+
+        for (int a = 0; a < h.Angles; a++)
+            for (int c = 0; c < h.Charges; c++) {
+                w.rot_ang = (float)(a * 5 - 50);
+                WorldInput fire = { FIRE, c / tickRate };
+                w.apply(fire);
+                // The step after launch plans the shot, which schedules the
+                // hit; one due at once has already happened
+                w.step(dt);
+                long when = -1;
+                if (w.score > 0)
+                    when = w.Ticks;
+                else if (!w.Scheduled.empty())
+                    when = w.Scheduled.front().Tick;
+                long after = when - base.Ticks;
+                out[a * h.Charges + c] = when >= 0 && after < OUTCOME_MISS ? (uint16_t)after : OUTCOME_MISS;
+
+                // Undo the shot and the step, far cheaper than a fresh copy
+                // of base; only a brick gone needs that
+                if (w.score > 0) {
+                    w = base;
+                    continue;
+                }
+                if (w.Shots.size() > 0)
+                    w.Shots.retire(0);
+                w.Scheduled.clear();
+                w.Bricks.Phase[0] = base.Bricks.Phase[0];
+                w.Ticks = base.Ticks;
+            }
+    });
+    if (stats)
+        *stats = ran;
+
+    FILE* f = fopen(path, "wb");
+    if (!f)
+        return 0;
+    bool ok = fwrite(&h, sizeof h, 1, f) == 1 &&
+              fwrite(entries.data(), sizeof(uint16_t), entries.size(), f) == entries.size();
+    ok = fclose(f) == 0 && ok;
+    return ok ? entries.size() : 0;
+}
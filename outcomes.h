@@ -0,0 +1,68 @@
+#ifndef OUTCOMES_H
+#define OUTCOMES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "workers.h"
+#include "world.h"
+
+/* What one shot does in the level reset() sets up, worked out ahead of
+   time. A shot starts from the cannon, so where it goes depends only on
+   the angle and the charge; shots never touch each other, and each brick
+   falls on its own cycle, back to phase 0 at every wrap. So whether and
+   when a shot hits a brick depends only on angle, charge and how many
+   ticks into its cycle that brick is at launch, and the table holds that
+   for every brick, angle, charge (in whole ticks held, as --deterministic
+   counts it) and cycle tick. Built once for a tick rate by stepping the
+   real simulation, then memory-mapped, so a lookup is a few array reads. */
+
+// Entry for a shot that never touches the brick
+const uint16_t OUTCOME_MISS = 0xffff;
+
+// Starts the file; the entries follow it directly, for each brick in Id
+// order Period[b] cycle ticks x Angles x Charges, ticks from launch to the
+// hit, the charge changing fastest
+struct OutcomeHeader {
+    char Magic[8];
+    uint64_t Level;           // World::hash() of the fresh level it was built for
+    double TickRate;
+    int32_t Angles;           // -50..50 in 5 degree steps
+    int32_t Charges;          // 0, 1 .. Charges - 1 ticks held
+    int32_t Bricks;
+    int32_t Period[WORLD_BRICKS];   // ticks from phase 0 to the wrap
+};
+
+struct OutcomeTable {
+    OutcomeTable ();
+    ~OutcomeTable ();
+
+    // Maps a table; false, and nothing loaded, if it can't be read or was
+    // built for another level or tick rate
+    bool open (const char* path, double tickRate);
+    void close ();
+    bool loaded () const { return Header != NULL; }
+    const OutcomeHeader* header () const { return Header; }
+
+    // The Id of the brick a shot fired in w now with charge, rounded to the
+    // whole ticks the table covers, would hit first, with ticks set to how
+    // long after launch, or -1 if it hits none or the table doesn't cover the shot
+    int predict (const World& w, double charge, long& ticks) const;
+
+private:
+    OutcomeTable (const OutcomeTable&);
+    OutcomeTable& operator= (const OutcomeTable&);
+
+    void* Map;
+    size_t Bytes;
+    const OutcomeHeader* Header;
+    const uint16_t* Entries;
+    size_t Start[WORLD_BRICKS];     // index of each brick's first entry
+};
+
+// Works out every entry on threads workers (0: all of them) and writes the
+// table to path; the number of entries, or 0 if it can't be written
+size_t buildOutcomeTable (const char* path, double tickRate, double maxCharge, int threads,
+                          ParallelStats* stats = NULL);
+
+#endif
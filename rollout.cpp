@@ -0,0 +1,66 @@
+#include <mutex>
+
+#include "rollout.h"
+#include "world.h"
+
+std::vector<RolloutSpec> sweepSpecs (double chargeStep, double maxCharge)
+{
+    std::vector<RolloutSpec> specs;
+    for (int angle = -50; angle <= 50; angle += 5)
+        // Counted in steps so the charges don't drift by repeated adding
+        for (int k = 1; k*chargeStep <= maxCharge + 1e-9; k++) {
+            RolloutSpec spec = { angle, k*chargeStep };
+            specs.push_back(spec);
+        }
+    return specs;
+}
+
+RolloutResult playRollout (const RolloutSpec& spec, const RolloutConfig& config)
+{
+    World w;
+    w.Collision = config.Collision;
+    // Turned with the keys, as a player would, so the angle is one they can reach
+    WorldInput turn = { spec.Angle < 0 ? AIM_DOWN : AIM_UP, 0 };
+    for (int k = 0; k < (spec.Angle < 0 ? -spec.Angle : spec.Angle) / 5; k++)
+        w.apply(turn);
+
+    RolloutResult result = { spec, 0, 0, -1 };
+    WorldInput fire = { FIRE, spec.Charge };
+    while (w.Ticks < config.MaxTicks) {
+        if (w.Shots.size() == 0) {
+            w.apply(fire);
+            result.Shots++;
+        }
+        w.step(config.Dt);
+        if (w.allHit()) {
+            result.ClearTick = w.Ticks;
+            break;
+        }
+    }
+    result.Hits = w.score;
+    return result;
+}
+
+std::vector<RolloutResult> runRollouts (const std::vector<RolloutSpec>& specs,
+                                        const RolloutConfig& config, int threads,
+                                        FILE* csv, ParallelStats* stats)
+{
+    std::vector<RolloutResult> results(specs.size());
+    std::mutex csvLock;
+    if (csv)
+        fprintf(csv, "index,angle,charge,shots,hits,clear_tick\n");
+
+    ParallelStats ran = parallelFor(specs.size(), threads, [&] (size_t i, int) {
+        RolloutResult r = playRollout(specs[i], config);
+        // Each worker writes its own slot; only the file is shared
+        results[i] = r;
+        if (csv) {
+            std::lock_guard<std::mutex> hold(csvLock);
+            fprintf(csv, "%zu,%d,%g,%d,%d,%ld\n", i, r.Spec.Angle, r.Spec.Charge,
+                    r.Shots, r.Hits, r.ClearTick);
+        }
+    });
+    if (stats)
+        *stats = ran;
+    return results;
+}
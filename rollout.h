@@ -0,0 +1,47 @@
+#ifndef ROLLOUT_H
+#define ROLLOUT_H
+
+#include <cstdio>
+#include <vector>
+
+#include "collide.h"
+#include "workers.h"
+
+/* Batch play for tuning levels. A rollout is a fresh game where the cannon
+   is turned to one angle and fired with one charge, again each time the
+   last shot has gone, until the bricks are cleared or time runs out.
+   Rollouts share nothing, so runRollouts() spreads them over threads with
+   parallelFor(); the simulation is deterministic, so a result is the same
+   whichever thread plays it. */
+
+struct RolloutSpec {
+    int Angle;                // rot_ang in degrees, a multiple of 5 in -50..50
+    double Charge;            // seconds the fire key is held
+};
+
+struct RolloutResult {
+    RolloutSpec Spec;
+    int Shots;                // fired
+    int Hits;                 // bricks hit, which is the score
+    long ClearTick;           // tick the last brick went, or -1
+};
+
+struct RolloutConfig {
+    CollisionMode Collision;
+    double Dt;                // seconds per tick
+    long MaxTicks;            // a rollout that hasn't cleared by then gives up
+};
+
+// Every angle the cannon stops at, each with charges step, 2 step, .. max
+std::vector<RolloutSpec> sweepSpecs (double chargeStep, double maxCharge);
+
+RolloutResult playRollout (const RolloutSpec& spec, const RolloutConfig& config);
+
+// Plays every spec on threads workers (0: one per hardware thread) and
+// returns the results in spec order. With csv, each rollout's row is written
+// as soon as it finishes, so rows come in finishing order.
+std::vector<RolloutResult> runRollouts (const std::vector<RolloutSpec>& specs,
+                                        const RolloutConfig& config, int threads,
+                                        FILE* csv, ParallelStats* stats = NULL);
+
+#endif
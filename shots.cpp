@@ -0,0 +1,80 @@
+#include "shots.h"
+#include "detmath.h"
+
+void Shot::aim (double angle, double speed)
+{
+    Vx = speed*detCos(angle);
+    Vy = speed*detSin(angle);
+}
+
+ShotPool::ShotPool (size_t capacity)
+    : Capacity(capacity)
+{
+    Active.reserve(Capacity);
+    Free.reserve(Capacity);
+    clear();
+}
+
+ShotPool::ShotPool (const ShotPool& other)
+    : Capacity(other.Capacity)
+{
+    Active.reserve(Capacity);
+    Free.reserve(Capacity);
+    *this = other;
+}
+
+ShotPool& ShotPool::operator= (const ShotPool& other)
+{
+    // Reserving first means assigning never has to grow anything
+    Capacity = other.Capacity;
+    Active.reserve(Capacity);
+    Free.reserve(Capacity);
+    Where.reserve(Capacity);
+    Active = other.Active;
+    Free = other.Free;
+    Where = other.Where;
+    return *this;
+}
+
+Shot* ShotPool::launch ()
+{
+    if (Free.empty())
+        return NULL;
+    int handle = Free.back();
+    Free.pop_back();
+    Where[handle] = (int)Active.size();
+
+    Shot s = { -99, 2, 0, 0, 0, 0, 0, 0, handle, -1, false };
+    Active.push_back(s);
+    return &Active.back();
+}
+
+void ShotPool::retire (size_t i)
+{
+    int handle = Active[i].Handle;
+    Where[handle] = -1;
+    Free.push_back(handle);
+
+    size_t last = Active.size() - 1;
+    if (i != last) {
+        Active[i] = Active[last];
+        Where[Active[i].Handle] = (int)i;
+    }
+    Active.pop_back();
+}
+
+void ShotPool::clear ()
+{
+    Active.clear();
+    Where.assign(Capacity, -1);
+    // Lowest handles out first
+    Free.clear();
+    for (size_t h = Capacity; h > 0; h--)
+        Free.push_back((int)(h - 1));
+}
+
+const Shot* ShotPool::find (int handle) const
+{
+    int i = handle >= 0 && (size_t)handle < Where.size() ? Where[handle] : -1;
+    return i >= 0 ? &Active[i] : NULL;
+}
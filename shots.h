@@ -0,0 +1,54 @@
+#ifndef SHOTS_H
+#define SHOTS_H
+
+#include <cstddef>
+#include <vector>
+
+/* Shots in flight, in a pool sized once up front so firing never allocates.
+   Active holds the live shots packed together, in no order, for a step to
+   stream through; retiring one moves the last into its place. Each shot
+   also takes a handle off a free-list that stays with it for its whole
+   flight, which is how a shot is found again after others have moved. */
+
+// Most shots in flight at once unless a pool is given another capacity;
+// firing with the pool full does nothing
+const size_t SHOT_CAPACITY = 4096;
+
+struct Shot {
+    double OriginX, OriginY;  // where it was fired from or last bounced
+    double Vx, Vy;            // velocity there, set at launch with aim()
+    double t;                 // flight time since then
+    double p, q;              // offset from the origin (x10)
+    long Launched;            // tick it was fired on
+    int Handle;
+    int Mirror;               // last one it bounced off, -1 for none
+    bool Planned;             // COLLIDE_PLANNED has scheduled its hits
+
+    void aim (double angle, double speed);
+    float x () const { return OriginX + p/10; }
+    float y () const { return OriginY + q/10; }
+};
+
+struct ShotPool {
+    explicit ShotPool (size_t capacity = SHOT_CAPACITY);
+    // Copies keep the full capacity, so a copy doesn't allocate either
+    ShotPool (const ShotPool& other);
+    ShotPool& operator= (const ShotPool& other);
+
+    std::vector<Shot> Active;
+
+    size_t size () const { return Active.size(); }
+    size_t capacity () const { return Capacity; }
+
+    Shot* launch ();                // at rest at the muzzle, NULL when full
+    void retire (size_t i);         // Active[i]; the last shot moves into i
+    void clear ();
+    const Shot* find (int handle) const;   // NULL once it has retired
+
+private:
+    size_t Capacity;
+    std::vector<int> Free;          // handles not in use, next out at the back
+    std::vector<int> Where;         // handle -> index into Active, -1 when free
+};
+
+#endif
@@ -0,0 +1,198 @@
+#include <algorithm>
+#include <cmath>
+#include <unordered_set>
+
+#include "solver.h"
+#include "workers.h"
+
+// A shot tried from a beam state, kept small: the world it leads to is
+// only rebuilt for the few the beam keeps
+struct Candidate {
+    size_t Parent;
+    int Wait, Angle, Charge;  // ticks, degrees, ticks held
+    long Tick;                // fired on
+    int Remaining;            // bricks neither hit nor scheduled after it
+    uint64_t Key;
+};
+
+struct BeamState {
+    World W;                  // the step after its last shot, that shot planned
+    std::vector<SolverAction> Actions;
+    int Remaining;
+};
+
+// Fewer bricks left first, then sooner; the rest only makes the order total
+static bool better (const Candidate& a, const Candidate& b)
+{
+    if (a.Remaining != b.Remaining) return a.Remaining < b.Remaining;
+    if (a.Tick != b.Tick) return a.Tick < b.Tick;
+    if (a.Parent != b.Parent) return a.Parent < b.Parent;
+    if (a.Angle != b.Angle) return a.Angle < b.Angle;
+    return a.Charge < b.Charge;
+}
+
+static uint64_t scramble (uint64_t x)
+{
+    // splitmix64's finaliser
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// Bricks still to hit in w, and a key for them: each brick neither hit nor
+// scheduled with the tick of its fall cycle it is on. Bricks fall the same
+// way every cycle and scheduled hits always land, so states with equal keys
+// need the same shots however many ticks apart they were reached, and
+// whenever their scheduled hits land. The key is the xor of a value per
+// brick Id, so the order rows are in doesn't matter.
+static int remaining (const World& w, double dt, std::vector<unsigned char>& scheduled, uint64_t& key)
+{
+    scheduled.assign(w.Bricks.NextId, 0);
+    for (size_t k = 0; k < w.Scheduled.size(); k++)
+        scheduled[w.Scheduled[k].Brick] = 1;
+    int left = 0;
+    key = 0;
+    for (size_t i = 0; i < w.Bricks.size(); i++)
+        if (w.Bricks.Alive[i] && !scheduled[w.Bricks.Id[i]]) {
+            // Every wrap puts the phase back to 0, so it counts ticks into the cycle
+            long cycle = w.Bricks.Rate[i] > 0 ? lround(w.Bricks.Phase[i] / (w.Bricks.Rate[i] * dt)) : 0;
+            key ^= scramble((uint64_t)w.Bricks.Id[i] << 32 ^ (uint64_t)cycle);
+            left++;
+        }
+    return left;
+}
+
+void fireAction (World& w, const SolverAction& action)
+{
+    WorldInput up = { AIM_UP, 0 }, down = { AIM_DOWN, 0 };
+    while (w.rot_ang < action.Angle)
+        w.apply(up);
+    while (w.rot_ang > action.Angle)
+        w.apply(down);
+    WorldInput fire = { FIRE, action.Charge };
+    w.apply(fire);
+}
+
+SolverResult solveLevel (const World& start, const SolverConfig& config)
+{
+    SolverResult result;
+    result.Solved = false;
+    result.Exhaustive = true;
+    result.WonTick = -1;
+    result.Shots = result.Pruned = 0;
+
+    int threads = config.Threads > 0 ? config.Threads : hardwareThreads();
+    int waits = config.MaxWait / config.WaitStep + 1;
+    int charges = config.MaxCharge / config.ChargeStep + 1;
+
+    // Only planned collision says what a shot will hit as soon as it is fired
+    std::vector<BeamState> beam(1);
+    beam[0].W = start;
+    beam[0].W.Collision = COLLIDE_PLANNED;
+    std::vector<unsigned char> scratchIds;
+    uint64_t key;
+    beam[0].Remaining = remaining(beam[0].W, config.Dt, scratchIds, key);
+    std::unordered_set<uint64_t> seen;
+    seen.insert(key);
+
+    // Per worker, so the expansion shares nothing it writes
+    std::vector<World> before(threads), after(threads);
+    std::vector<std::vector<unsigned char> > ids(threads);
+    std::vector<std::vector<Candidate> > found(threads);
+    std::vector<size_t> shots(threads), pruned(threads);
+
+    for (int depth = 0; depth < config.MaxShots && !beam.empty() && beam[0].Remaining > 0; depth++) {
+        for (int t = 0; t < threads; t++)
+            found[t].clear();
+
+        parallelFor(beam.size() * waits, threads, [&] (size_t task, int worker) {
+            size_t parent = task / waits;
+            int wait = (int)(task % waits) * config.WaitStep;
+            World& at = before[worker];
+            at = beam[parent].W;
+            for (int k = 0; k < wait; k++)
+                at.step(config.Dt);
+
+            for (int a = -50; a <= 50; a += 5)
+                for (int c = 0; c < charges; c++) {
+                    World& w = after[worker];
+                    w = at;
+                    SolverAction action = { at.Ticks, a, c * config.ChargeStep * config.Dt };
+                    fireAction(w, action);
+                    w.step(config.Dt);
+                    shots[worker]++;
+
+                    Candidate next = { parent, wait, a, c * config.ChargeStep, at.Ticks, 0, 0 };
+                    next.Remaining = remaining(w, config.Dt, ids[worker], next.Key);
+                    // A shot that adds no hit never shortens the game
+                    if (next.Remaining >= beam[parent].Remaining)
+                        continue;
+                    if (seen.count(next.Key)) {
+                        pruned[worker]++;
+                        continue;
+                    }
+                    found[worker].push_back(next);
+                }
+        });
+
+        std::vector<Candidate> all;
+        for (int t = 0; t < threads; t++)
+            all.insert(all.end(), found[t].begin(), found[t].end());
+        std::sort(all.begin(), all.end(), better);
+
+        // The best Beam of the states no cheaper path reached, rebuilt
+        std::vector<BeamState> next;
+        for (size_t k = 0; k < all.size(); k++) {
+            const Candidate& c = all[k];
+            if (seen.count(c.Key)) {
+                result.Pruned++;
+                continue;
+            }
+            if ((int)next.size() == config.Beam) {
+                result.Exhaustive = false;
+                break;
+            }
+            seen.insert(c.Key);
+            const BeamState& parent = beam[c.Parent];
+            BeamState s;
+            s.W = parent.W;
+            for (int t = 0; t < c.Wait; t++)
+                s.W.step(config.Dt);
+            SolverAction action = { c.Tick, c.Angle, c.Charge * config.Dt };
+            fireAction(s.W, action);
+            s.W.step(config.Dt);
+            s.Actions = parent.Actions;
+            s.Actions.push_back(action);
+            s.Remaining = c.Remaining;
+            next.push_back(s);
+            if (c.Remaining == 0)
+                break;        // sorted first, so the soonest win with fewest shots
+        }
+        beam.swap(next);
+    }
+
+    for (int t = 0; t < threads; t++) {
+        result.Shots += shots[t];
+        result.Pruned += pruned[t];
+    }
+    result.States = seen.size();
+    if (beam.empty() || beam[0].Remaining > 0)
+        return result;
+
+    // Play the answer through from the start, in its own collision mode,
+    // to the win
+    result.Solved = true;
+    result.Actions = beam[0].Actions;
+    World w = start;
+    size_t k = 0;
+    long limit = result.Actions.back().Tick + (long)(3600 / config.Dt);
+    while (!w.Won && w.Ticks < limit) {
+        while (k < result.Actions.size() && result.Actions[k].Tick == w.Ticks)
+            fireAction(w, result.Actions[k++]);
+        w.step(config.Dt);
+    }
+    if (w.Won)
+        result.WonTick = w.Ticks;
+    return result;
+}
@@ -0,0 +1,52 @@
+#ifndef SOLVER_H
+#define SOLVER_H
+
+#include <stddef.h>
+#include <vector>
+
+#include "world.h"
+
+/* Finds the fewest shots that clear a level, for checking a level can be
+   won and how hard it is. A beam search over shots: depth d holds the best
+   Beam states reached with d shots, and each is tried with every fire tick,
+   angle and charge on a grid. A shot's hits are settled the step after it
+   is fired, when COLLIDE_PLANNED schedules them, so one step of a copy of
+   the world tells what a shot does; a state is the bricks neither hit nor
+   scheduled, each at its tick of its fall cycle. Expanding a depth is
+   spread over threads, all reading one transposition cache of states
+   already reached with fewer shots; it is only written between depths, so
+   the search goes the same whatever the threads do. If the beam never had to drop a state the
+   answer is the minimum for the grid, not just the best found. */
+
+struct SolverAction {
+    long Tick;                // World::Ticks when it is fired
+    int Angle;                // rot_ang, turned to with AIM inputs first
+    double Charge;            // seconds held
+};
+
+struct SolverConfig {
+    double Dt;
+    int Beam;                 // states kept per depth
+    int MaxShots;             // gives up after this many
+    int WaitStep, MaxWait;    // ticks from one shot to the next: 0, WaitStep .. MaxWait
+    int ChargeStep, MaxCharge;  // charges tried, in ticks held
+    int Threads;              // 0 is one per hardware thread
+};
+
+struct SolverResult {
+    bool Solved;
+    bool Exhaustive;          // the beam never dropped a state
+    std::vector<SolverAction> Actions;
+    long WonTick;             // replaying Actions in the start's collision mode, or -1
+    size_t Shots;             // simulated while searching
+    size_t Pruned;            // shots that led to a state already in the cache, or
+                              // one a better shot of the same depth reached
+    size_t States;            // in the cache at the end
+};
+
+SolverResult solveLevel (const World& start, const SolverConfig& config);
+
+// Turns w's cannon to angle with AIM inputs and fires, as a player would
+void fireAction (World& w, const SolverAction& action);
+
+#endif
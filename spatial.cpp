@@ -0,0 +1,105 @@
+#include "spatial.h"
+
+using namespace std;
+
+SpatialHash::SpatialHash (float cellSize)
+    : CellSize(cellSize), InvCell(1 / cellSize), Mask(0), Heads(2, 0), Query(0)
+{
+}
+
+void SpatialHash::clear ()
+{
+    Items.clear();
+}
+
+int SpatialHash::cell (float v) const
+{
+    // floor without the libm call; truncation rounds negatives the wrong way
+    float f = v * InvCell;
+    int i = (int)f;
+    return i - (f < i);
+}
+
+unsigned SpatialHash::bucket (int cx, int cy) const
+{
+    return ((unsigned)cx * 73856093u ^ (unsigned)cy * 19349663u) & Mask;
+}
+
+void SpatialHash::insert (int id, float minX, float minY, float maxX, float maxY)
+{
+    // Buckets are assigned in build() once the table size is known
+    int x0 = cell(minX), x1 = cell(maxX), y0 = cell(minY), y1 = cell(maxY);
+    for (int cy = y0; cy <= y1; cy++)
+        for (int cx = x0; cx <= x1; cx++) {
+            Staged s = { cx, cy, id, 0 };
+            Items.push_back(s);
+        }
+}
+
+void SpatialHash::build ()
+{
+    size_t n = Items.size();
+    unsigned buckets = 1;
+    while (buckets < n)
+        buckets <<= 1;
+    Mask = buckets - 1;
+
+    Heads.assign(buckets + 1, 0);
+    int maxId = -1;
+    for (size_t i = 0; i < n; i++) {
+        Staged& s = Items[i];
+        s.Bucket = bucket(s.CellX, s.CellY);
+        Heads[s.Bucket + 1]++;
+        if (s.Id > maxId)
+            maxId = s.Id;
+    }
+    for (unsigned b = 0; b < buckets; b++)
+        Heads[b + 1] += Heads[b];
+
+    Entries.resize(n);
+    for (size_t i = 0; i < n; i++) {
+        const Staged& s = Items[i];
+        // Heads[b] runs ahead while filling and is wound back below
+        Entries[Heads[s.Bucket]++] = s.Id;
+    }
+    for (unsigned b = buckets; b > 0; b--)
+        Heads[b] = Heads[b - 1];
+    Heads[0] = 0;
+
+    if (Stamps.size() < (size_t)(maxId + 1))
+        Stamps.resize(maxId + 1, Query);
+}
+
+void SpatialHash::query (float minX, float minY, float maxX, float maxY, vector<int>& out)
+{
+    collect(minX, minY, maxX, maxY, out, Stamps, Query);
+}
+
+void SpatialHash::query (float minX, float minY, float maxX, float maxY, SpatialScratch& scratch) const
+{
+    // Ids past the scratch's stamps are new to it; 0 is older than any query
+    if (scratch.Stamps.size() < Stamps.size())
+        scratch.Stamps.resize(Stamps.size(), 0);
+    collect(minX, minY, maxX, maxY, scratch.Found, scratch.Stamps, scratch.Query);
+}
+
+void SpatialHash::collect (float minX, float minY, float maxX, float maxY, vector<int>& out,
+                           vector<unsigned>& stamps, unsigned& query) const
+{
+    if (++query == 0) {             // stamps wrapped: forget them all
+        stamps.assign(stamps.size(), 0);
+        query = 1;
+    }
+    int x0 = cell(minX), x1 = cell(maxX), y0 = cell(minY), y1 = cell(maxY);
+    for (int cy = y0; cy <= y1; cy++)
+        for (int cx = x0; cx <= x1; cx++) {
+            unsigned b = bucket(cx, cy);
+            for (unsigned e = Heads[b]; e < Heads[b + 1]; e++) {
+                int id = Entries[e];
+                if (stamps[id] != query) {
+                    stamps[id] = query;
+                    out.push_back(id);
+                }
+            }
+        }
+}
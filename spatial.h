@@ -0,0 +1,59 @@
+#ifndef SPATIAL_H
+#define SPATIAL_H
+
+#include <vector>
+
+/* Broad phase: a uniform grid over the plane, hashed into a table sized to
+   the item count so it needs no world bounds. Items are staged with insert()
+   and counting-sorted into buckets by build(), O(n) per rebuild; a query
+   walks the buckets of the cells its box covers, so its cost follows the
+   area asked about rather than how many items there are. Cells that hash to
+   the same bucket share it, so results are candidates for a narrow phase. */
+
+// What a query found, and the stamps that keep it from finding an item
+// twice, for one caller at a time
+struct SpatialScratch {
+    SpatialScratch () : Query(0) {}
+
+    std::vector<int> Found;
+    std::vector<unsigned> Stamps;   // per id, the last query that returned it
+    unsigned Query;
+};
+
+struct SpatialHash {
+    explicit SpatialHash (float cellSize = 16);
+
+    void clear ();
+    void insert (int id, float minX, float minY, float maxX, float maxY);
+    void build ();
+
+    // Appends each item whose cells meet the box to out, once
+    void query (float minX, float minY, float maxX, float maxY, std::vector<int>& out);
+    // The same into scratch.Found with scratch's stamps, so threads that
+    // each have their own can query at once
+    void query (float minX, float minY, float maxX, float maxY, SpatialScratch& scratch) const;
+
+    float CellSize;
+
+private:
+    struct Staged {
+        int CellX, CellY;
+        int Id;
+        unsigned Bucket;
+    };
+
+    unsigned bucket (int cx, int cy) const;
+    int cell (float v) const;
+    void collect (float minX, float minY, float maxX, float maxY, std::vector<int>& out,
+                  std::vector<unsigned>& stamps, unsigned& query) const;
+
+    float InvCell;
+    unsigned Mask;                  // bucket count - 1, a power of two
+    std::vector<Staged> Items;      // one per item per covered cell
+    std::vector<unsigned> Heads;    // bucket -> first entry, plus an end marker
+    std::vector<int> Entries;       // item ids grouped by bucket
+    std::vector<unsigned> Stamps;   // per id, the last query that returned it
+    unsigned Query;
+};
+
+#endif
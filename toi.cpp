@@ -0,0 +1,132 @@
+#include <cmath>
+#include <algorithm>
+
+#include "toi.h"
+
+// Bisection steps per root; 2^-64 of the bracket is below double precision
+const int TOI_BISECT_STEPS = 64;
+// Leading terms this small next to the largest are treated as zero
+const double TOI_DEGENERATE = 1e-14;
+// How far below zero a polynomial may evaluate at one of its own roots
+const double TOI_SLACK = 1e-9;
+
+double polyEval (const double* c, int n, double s)
+{
+    double v = c[n];
+    for (int i = n - 1; i >= 0; i--)
+        v = v*s + c[i];
+    return v;
+}
+
+void polyMul (const double* a, int na, const double* b, int nb, double* out)
+{
+    for (int i = 0; i <= na + nb; i++)
+        out[i] = 0;
+    for (int i = 0; i <= na; i++)
+        for (int j = 0; j <= nb; j++)
+            out[i + j] += a[i] * b[j];
+}
+
+static double bisect (const double* c, int n, double a, double b, double fa)
+{
+    for (int i = 0; i < TOI_BISECT_STEPS; i++) {
+        double m = 0.5 * (a + b);
+        if (m <= a || m >= b)
+            break;
+        double fm = polyEval(c, n, m);
+        if (fm == 0)
+            return m;
+        if ((fm < 0) == (fa < 0)) {
+            a = m;
+            fa = fm;
+        }
+        else
+            b = m;
+    }
+    return 0.5 * (a + b);
+}
+
+static void addRoot (double* roots, int& count, double r)
+{
+    if (count == 0 || roots[count - 1] != r)
+        roots[count++] = r;
+}
+
+/* Between two neighbouring roots of the derivative the polynomial is
+   monotonic, so it has a root there exactly when its sign changes. */
+int polyRoots (const double* c, int n, double lo, double hi, double* roots)
+{
+    double largest = 0;
+    for (int i = 0; i <= n; i++)
+        largest = fmax(largest, fabs(c[i]));
+    while (n > 0 && fabs(c[n]) <= TOI_DEGENERATE * largest)
+        n--;
+    if (n == 0 || lo > hi)
+        return 0;
+    if (n == 1) {
+        double r = -c[0] / c[1];
+        if (r < lo || r > hi)
+            return 0;
+        roots[0] = r;
+        return 1;
+    }
+
+    double d[TOI_MAX_DEGREE] = {};
+    for (int i = 1; i <= n; i++)
+        d[i - 1] = i * c[i];
+    double ends[TOI_MAX_DEGREE + 1];
+    ends[0] = lo;
+    int count = 1 + polyRoots(d, n - 1, lo, hi, ends + 1);
+    ends[count++] = hi;
+
+    int found = 0;
+    double fa = polyEval(c, n, ends[0]);
+    for (int i = 0; i + 1 < count; i++) {
+        double a = ends[i], b = ends[i + 1];
+        double fb = polyEval(c, n, b);
+        if (fa == 0)
+            addRoot(roots, found, a);
+        else if (fb != 0 && (fa < 0) != (fb < 0))
+            addRoot(roots, found, bisect(c, n, a, b, fa));
+        fa = fb;
+    }
+    if (fa == 0)
+        addRoot(roots, found, hi);
+    return found;
+}
+
+double polyFirstContact (const double* c, int n, double lo, double hi)
+{
+    if (lo > hi)
+        return -1;
+    if (polyEval(c, n, lo) <= 0)
+        return lo;
+    double roots[TOI_MAX_DEGREE + 1];
+    if (polyRoots(c, n, lo, hi, roots) == 0)
+        return -1;
+    return roots[0];
+}
+
+/* The set where every condition holds is a union of closed intervals, and
+   each starts either at lo or at a root of one of the conditions, so the
+   first candidate that passes them all is the answer. */
+double polyFirstInside (const double* const* c, const int* n, int count, double lo, double hi)
+{
+    if (lo > hi)
+        return -1;
+    double candidates[1 + TOI_MAX_CONDITIONS * (TOI_MAX_DEGREE + 1)];
+    int m = 0;
+    candidates[m++] = lo;
+    for (int k = 0; k < count; k++)
+        m += polyRoots(c[k], n[k], lo, hi, candidates + m);
+    std::sort(candidates, candidates + m);
+
+    for (int i = 0; i < m; i++) {
+        int k = 0;
+        while (k < count && polyEval(c[k], n[k], candidates[i]) >= -TOI_SLACK)
+            k++;
+        if (k == count)
+            return candidates[i];
+    }
+    return -1;
+}
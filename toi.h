@@ -0,0 +1,29 @@
+#ifndef TOI_H
+#define TOI_H
+
+/* Time of impact root finding. Shot and brick paths are polynomials in time,
+   so the squared gap between them minus the contact distance squared is too;
+   the first contact is that polynomial's first root. */
+
+const int TOI_MAX_DEGREE = 4;
+// Most polynomials polyFirstInside takes at once
+const int TOI_MAX_CONDITIONS = 4;
+
+// Value of c[0] + c[1]s + ... + c[n]s^n at s
+double polyEval (const double* c, int n, double s);
+
+// Product of an a-degree and a b-degree polynomial, written to out (a+b+1 terms)
+void polyMul (const double* a, int na, const double* b, int nb, double* out);
+
+// Real roots of c[0] + c[1]s + ... + c[n]s^n in [lo, hi], ascending; returns
+// how many were written (roots needs room for n + 1). n is at most TOI_MAX_DEGREE.
+int polyRoots (const double* c, int n, double lo, double hi, double* roots);
+
+// First s in [lo, hi] at which the polynomial is <= 0, or -1 if it stays positive
+double polyFirstContact (const double* c, int n, double lo, double hi);
+
+// First s in [lo, hi] at which all count polynomials c[k], of degree n[k], are
+// >= 0 together, or -1 if they never are
+double polyFirstInside (const double* const* c, const int* n, int count, double lo, double hi);
+
+#endif
@@ -0,0 +1,240 @@
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "workers.h"
+
+// One worker's queue of chunks or tasks. The owner and thieves take from
+// opposite ends, so they only meet over the last item; an item takes far
+// longer to run than the lock does to take.
+struct StealDeque {
+    std::mutex Lock;
+    std::deque<size_t> Items;
+
+    void push (size_t item)
+    {
+        std::lock_guard<std::mutex> hold(Lock);
+        Items.push_back(item);
+    }
+
+    bool popFront (size_t& item)
+    {
+        std::lock_guard<std::mutex> hold(Lock);
+        if (Items.empty())
+            return false;
+        item = Items.front();
+        Items.pop_front();
+        return true;
+    }
+
+    bool popBack (size_t& item)
+    {
+        std::lock_guard<std::mutex> hold(Lock);
+        if (Items.empty())
+            return false;
+        item = Items.back();
+        Items.pop_back();
+        return true;
+    }
+};
+
+int hardwareThreads ()
+{
+    unsigned n = std::thread::hardware_concurrency();
+    return n > 0 ? (int)n : 1;
+}
+
+static void work (int self, std::vector<StealDeque>& deques, size_t count, size_t grain,
+                  const std::function<void (size_t, int)>& body, size_t& steals)
+{
+    int n = (int)deques.size();
+    steals = 0;
+    for (;;) {
+        size_t chunk;
+        bool found = deques[self].popFront(chunk);
+        // Victims in turn from the next worker on, so thieves spread out
+        for (int k = 1; !found && k < n; k++)
+            if (deques[(self + k) % n].popBack(chunk)) {
+                found = true;
+                steals++;
+            }
+        if (!found)
+            return;
+
+        size_t end = std::min(count, (chunk + 1)*grain);
+        for (size_t i = chunk*grain; i < end; i++)
+            body(i, self);
+    }
+}
+
+ParallelStats parallelFor (size_t count, int threads,
+                           const std::function<void (size_t, int)>& body, size_t grain)
+{
+    if (threads <= 0)
+        threads = hardwareThreads();
+    if (grain == 0)
+        grain = 1;
+    size_t chunks = (count + grain - 1) / grain;
+    if ((size_t)threads > chunks)
+        threads = chunks > 0 ? (int)chunks : 1;
+
+    std::vector<StealDeque> deques(threads);
+    for (int w = 0; w < threads; w++)
+        for (size_t c = chunks*w/threads; c < chunks*(w + 1)/threads; c++)
+            deques[w].Items.push_back(c);
+
+    std::vector<size_t> steals(threads);
+    std::vector<std::thread> pool;
+    for (int w = 1; w < threads; w++)
+        pool.push_back(std::thread(work, w, std::ref(deques), count, grain,
+                                   std::cref(body), std::ref(steals[w])));
+    work(0, deques, count, grain, body, steals[0]);
+    for (size_t w = 0; w < pool.size(); w++)
+        pool[w].join();
+
+    ParallelStats stats = { threads, chunks, 0 };
+    for (int w = 0; w < threads; w++)
+        stats.Steals += steals[w];
+    return stats;
+}
+
+int TaskGraph::add (const char* name, const std::function<void ()>& body)
+{
+    Task t;
+    t.Name = name;
+    t.Body = body;
+    t.Waits = 0;
+    Tasks.push_back(t);
+    resetTimings();
+    return (int)Tasks.size() - 1;
+}
+
+void TaskGraph::precede (int before, int after)
+{
+    Tasks[before].Next.push_back(after);
+    Tasks[after].Waits++;
+}
+
+void TaskGraph::resetTimings ()
+{
+    TaskTiming zero = { 0, 0, 0, 0, 0, -1 };
+    for (size_t i = 0; i < Tasks.size(); i++)
+        Tasks[i].Timing = zero;
+}
+
+void TaskGraph::dumpTimings (FILE* out) const
+{
+    fprintf(out, "%-12s %8s %10s %10s %10s %10s %6s\n", "task", "runs", "mean us", "max us",
+            "start us", "last us", "worker");
+    for (size_t i = 0; i < Tasks.size(); i++) {
+        const TaskTiming& t = Tasks[i].Timing;
+        fprintf(out, "%-12s %8ld %10.2f %10.2f %10.2f %10.2f %6d\n", Tasks[i].Name, t.Runs,
+                t.Runs ? 1e6 * t.Total / t.Runs : 0.0, 1e6 * t.Max, 1e6 * t.LastStart,
+                1e6 * t.LastTime, t.LastWorker);
+    }
+}
+
+JobPool::JobPool (int workers)
+    : Queued(0), Left(0), Graph(NULL), Quit(false)
+{
+    Count = workers > 0 ? workers : std::max(hardwareThreads() - 1, 1);
+    Queues.reset(new StealDeque[Count]);
+    for (int w = 0; w < Count; w++)
+        Threads.push_back(std::thread(&JobPool::work, this, w));
+}
+
+JobPool::~JobPool ()
+{
+    {
+        std::lock_guard<std::mutex> hold(Lock);
+        Quit = true;
+    }
+    Wake.notify_all();
+    for (size_t w = 0; w < Threads.size(); w++)
+        Threads[w].join();
+}
+
+void JobPool::push (int worker, int task)
+{
+    Queues[worker].push(task);
+    Queued++;
+    // Taking the lock orders this against a worker about to sleep, so it
+    // either sees the task or gets the notify
+    { std::lock_guard<std::mutex> hold(Lock); }
+    Wake.notify_one();
+}
+
+void JobPool::start (TaskGraph& graph)
+{
+    size_t n = graph.Tasks.size();
+    if (graph.PendingSize != n) {
+        graph.Pending.reset(new std::atomic<int>[n]);
+        graph.PendingSize = n;
+    }
+    for (size_t i = 0; i < n; i++)
+        graph.Pending[i] = graph.Tasks[i].Waits;
+    Graph = &graph;
+    Began = std::chrono::steady_clock::now();
+    Left = (int)n;
+
+    int w = 0;
+    for (size_t i = 0; i < n; i++)
+        if (graph.Tasks[i].Waits == 0) {
+            push(w, (int)i);
+            w = (w + 1) % workers();
+        }
+}
+
+void JobPool::wait ()
+{
+    std::unique_lock<std::mutex> hold(Lock);
+    Finished.wait(hold, [this] { return Left.load() == 0; });
+}
+
+void JobPool::execute (int self, int task)
+{
+    TaskGraph::Task& t = Graph->Tasks[task];
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    t.Body();
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+
+    TaskTiming& timing = t.Timing;
+    timing.LastStart = std::chrono::duration<double>(begin - Began).count();
+    timing.LastTime = std::chrono::duration<double>(end - begin).count();
+    timing.LastWorker = self;
+    timing.Runs++;
+    timing.Total += timing.LastTime;
+    timing.Max = std::max(timing.Max, timing.LastTime);
+
+    for (size_t k = 0; k < t.Next.size(); k++)
+        if (--Graph->Pending[t.Next[k]] == 0)
+            push(self, t.Next[k]);
+    if (--Left == 0) {
+        { std::lock_guard<std::mutex> hold(Lock); }
+        Finished.notify_all();
+    }
+}
+
+void JobPool::work (int self)
+{
+    int n = workers();
+    for (;;) {
+        size_t task;
+        bool found = Queues[self].popBack(task);
+        for (int k = 1; !found && k < n; k++)
+            found = Queues[(self + k) % n].popFront(task);
+        if (found) {
+            Queued--;
+            execute(self, (int)task);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> hold(Lock);
+        Wake.wait(hold, [this] { return Quit || Queued.load() > 0; });
+        if (Quit)
+            return;
+    }
+}
@@ -0,0 +1,124 @@
+#ifndef WORKERS_H
+#define WORKERS_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* A parallel for with work stealing. The range [0, count) is cut into
+   chunks of grain indices and each worker starts with an even, contiguous
+   share of them in its own deque. A worker runs its chunks in order from
+   the front of its deque; once that runs dry it steals from the back of
+   the others', the work their owners would reach last, so workers whose
+   chunks finish early take over from those whose chunks run long. Nothing
+   is added once it starts, so a worker that finds every deque empty is
+   done. */
+
+// Threads the machine runs at once, at least 1
+int hardwareThreads ();
+
+struct ParallelStats {
+    int Threads;
+    size_t Chunks;
+    size_t Steals;            // chunks a worker ran from another's deque
+};
+
+// Calls body(index, worker) for every index in [0, count) on threads
+// workers, 0 meaning one per hardware thread, and returns once all are done.
+// Worker numbers run 0..threads-1; the calling thread is worker 0.
+ParallelStats parallelFor (size_t count, int threads,
+                           const std::function<void (size_t, int)>& body, size_t grain = 1);
+
+/* A job system for work that repeats, like a frame's update. A TaskGraph
+   is built once: named tasks, each with the tasks it must wait for. A
+   JobPool's fixed workers run it as often as asked. At the start of a run
+   every task's counter is set to the number it waits for and those with
+   none are dealt out to the workers' deques; each finished task counts its
+   successors down and pushes any that reach zero onto its own worker's
+   deque. A worker runs the newest task in its deque, whose inputs were
+   just written, and when it has none steals the oldest from another's.
+   The thread that starts a run is not a worker, so it is free to do other
+   work, such as GL calls, until it waits for the run to finish. */
+
+// Seconds; LastStart is from the start of the run
+struct TaskTiming {
+    long Runs;
+    double Total, Max;
+    double LastStart, LastTime;
+    int LastWorker;
+};
+
+struct TaskGraph {
+    TaskGraph () : PendingSize(0) {}
+
+    // Task ids count up from 0 in the order they are added
+    int add (const char* name, const std::function<void ()>& body);
+    // after waits for before to finish
+    void precede (int before, int after);
+    size_t size () const { return Tasks.size(); }
+
+    const TaskTiming& timing (int task) const { return Tasks[task].Timing; }
+    void resetTimings ();
+    // A line per task: runs, mean and worst time, and the last run's start,
+    // time and worker
+    void dumpTimings (FILE* out) const;
+
+private:
+    friend struct JobPool;
+
+    struct Task {
+        const char* Name;
+        std::function<void ()> Body;
+        std::vector<int> Next;
+        int Waits;
+        TaskTiming Timing;
+    };
+    std::vector<Task> Tasks;
+    std::unique_ptr<std::atomic<int>[]> Pending;   // per task, during a run
+    size_t PendingSize;
+};
+
+struct StealDeque;
+
+struct JobPool {
+    // 0 workers is one per hardware thread but the one that starts runs,
+    // which is busy too, and at least 1
+    explicit JobPool (int workers = 0);
+    ~JobPool ();
+
+    int workers () const { return Count; }
+
+    // Runs graph on the workers and returns at once; graph must not change
+    // or be started again until wait() has returned
+    void start (TaskGraph& graph);
+    void wait ();
+    void run (TaskGraph& graph) { start(graph); wait(); }
+
+private:
+    JobPool (const JobPool&);
+    JobPool& operator= (const JobPool&);
+
+    void work (int self);
+    void push (int worker, int task);
+    void execute (int self, int task);
+
+    int Count;
+    std::vector<std::thread> Threads;
+    std::unique_ptr<StealDeque[]> Queues;
+    std::mutex Lock;
+    std::condition_variable Wake, Finished;
+    std::atomic<int> Queued;      // tasks sitting in the deques
+    std::atomic<int> Left;        // tasks of this run not yet finished
+    TaskGraph* Graph;
+    std::chrono::steady_clock::time_point Began;
+    bool Quit;
+};
+
+#endif
@@ -0,0 +1,593 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "world.h"
+#include "detmath.h"
+#include "toi.h"
+#include "brickstep.h"
+
+const float MOVE_UNIT = 1.5f;
+const float AIM_STEP = 5, AIM_LIMIT = 50;
+const double SHOT_SPEED = 15;
+const float SHOT_RADIUS = 1;
+// The hit box is the brick grown by this much on each side, which reaches
+// as far along the axes as the 7 unit hit circle it replaced
+const float BRICK_HIT_MARGIN = 4;
+const float BRICK_HALF = 3;
+// Bricks go back to the top once they have fallen this far
+const double BRICK_FALL_LIMIT = 170;
+// Shot flight time t advances this much per second
+const double SHOT_TIME_RATE = 0.08 * WORLD_REFERENCE_HZ;
+// Longest a plan looks ahead, in seconds; gravity brings every shot down well before
+const double PLAN_HORIZON = 3600;
+// Most bounces a shot makes in one step, and that a plan follows; a shot
+// caught between mirrors goes straight through once it runs out
+const int STEP_MAX_BOUNCES = 8;
+const int PLAN_MAX_BOUNCES = 256;
+// With more shots than one out, bricks go in a grid from this many on;
+// below it each shot just checks every brick's box
+const size_t GRID_MIN_BRICKS = 64;
+
+// Orders Scheduled as a min-heap
+static bool later (const HitEvent& a, const HitEvent& b)
+{
+    return a.Tick > b.Tick;
+}
+
+World::World (size_t shotCapacity)
+    : Shots(shotCapacity)
+{
+    Collision = COLLIDE_PLANNED;
+    Queried = false;
+    Moves.reserve(shotCapacity);
+    reset();
+}
+
+// to = from, with room for as much as from has room for
+template <typename T>
+static void assignKeepingRoom (std::vector<T>& to, const std::vector<T>& from)
+{
+    to.reserve(from.capacity());
+    to = from;
+}
+
+World::World (const World& other)
+    : Shots(other.Shots.capacity())
+{
+    *this = other;
+}
+
+World& World::operator= (const World& other)
+{
+    x = other.x; y = other.y;
+    X = other.X; Y = other.Y;
+    rot_ang = other.rot_ang;
+    Shots = other.Shots;
+    Mirrors = other.Mirrors;
+    Bricks = other.Bricks;
+    Collision = other.Collision;
+    assignKeepingRoom(Scheduled, other.Scheduled);
+    assignKeepingRoom(Aimed, other.Aimed);
+    Replan = other.Replan;
+    PlanDt = other.PlanDt;
+    score = other.score;
+    Won = other.Won;
+    Ticks = other.Ticks;
+    assignKeepingRoom(WrappedMask, other.WrappedMask);
+    assignKeepingRoom(HitMask, other.HitMask);
+    assignKeepingRoom(Candidates, other.Candidates);
+    assignKeepingRoom(Moves, other.Moves);
+    Queried = other.Queried;
+    assignKeepingRoom(MirrorNear.Found, other.MirrorNear.Found);
+    assignKeepingRoom(MirrorNear.Stamps, other.MirrorNear.Stamps);
+    MirrorNear.Query = other.MirrorNear.Query;
+    assignKeepingRoom(Near, other.Near);
+    Grid = other.Grid;
+    return *this;
+}
+
+void World::reset ()
+{
+    x = -20; y = -84;
+    X = 20; Y = -84;
+    rot_ang = 0;
+    Shots.clear();
+    Scheduled.clear();
+    Replan = true;
+    PlanDt = 0;
+    score = 0;
+    Won = false;
+    Ticks = 0;
+
+    Mirrors.clear();
+    addMirror(72, -2, 82, 22);
+
+    const float origins[WORLD_BRICKS][2] = { { 0, 93 }, { 14, 89 }, { 28, 88 } };
+    const double rates[WORLD_BRICKS] = { 1.2, 1.8, 2.4 };
+    Bricks.clear();
+    for (int i = 0; i < WORLD_BRICKS; i++)
+        addBrick(origins[i][0], origins[i][1], rates[i]);
+}
+
+void World::addBrick (float originX, float originY, double rate)
+{
+    Bricks.add(originX + BRICK_HALF, originY + BRICK_HALF, BRICK_HALF, rate);
+    Replan = true;
+}
+
+void World::addMirror (double ax, double ay, double bx, double by)
+{
+    Mirrors.add(ax, ay, bx, by);
+    Replan = true;
+}
+
+void World::apply (const WorldInput& input)
+{
+    switch (input.Action) {
+        case AIM_UP:
+            rot_ang = rot_ang >= AIM_LIMIT ? AIM_LIMIT : rot_ang + AIM_STEP;
+            break;
+        case AIM_DOWN:
+            rot_ang = rot_ang <= -AIM_LIMIT ? -AIM_LIMIT : rot_ang - AIM_STEP;
+            break;
+        case BASKET1_LEFT:
+            x -= MOVE_UNIT;
+            break;
+        case BASKET1_RIGHT:
+            x += MOVE_UNIT;
+            break;
+        case BASKET2_LEFT:
+            X -= MOVE_UNIT;
+            break;
+        case BASKET2_RIGHT:
+            X += MOVE_UNIT;
+            break;
+        case FIRE:
+            // A new shot each time, flying at the angle the cannon has now
+            if (Shot* shot = Shots.launch()) {
+                shot->aim(rot_ang*M_PI/180, SHOT_SPEED * input.Charge * 2.5);
+                shot->Launched = Ticks;
+            }
+            break;
+    }
+}
+
+bool World::allHit () const
+{
+    return Bricks.size() == 0;
+}
+
+// FNV-1a over a value's bytes, low byte first whatever the machine's order
+static void mix (uint64_t& h, uint64_t v)
+{
+    for (int i = 0; i < 8; i++) {
+        h ^= (v >> (8*i)) & 0xff;
+        h *= 1099511628211ull;
+    }
+}
+
+static void mix (uint64_t& h, double v)
+{
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof bits);
+    mix(h, bits);
+}
+
+static void mix (uint64_t& h, float v)
+{
+    uint32_t bits;
+    memcpy(&bits, &v, sizeof bits);
+    mix(h, (uint64_t)bits);
+}
+
+static void mix (uint64_t& h, long v)
+{
+    mix(h, (uint64_t)(int64_t)v);
+}
+
+static void mix (uint64_t& h, int v)
+{
+    mix(h, (uint64_t)(int64_t)v);
+}
+
+uint64_t World::hash () const
+{
+    uint64_t h = 14695981039346656037ull;
+    mix(h, x); mix(h, y); mix(h, X); mix(h, Y);
+    mix(h, rot_ang);
+    mix(h, (int)Collision);
+    mix(h, (int)Replan);
+    mix(h, PlanDt);
+    mix(h, score);
+    mix(h, (int)Won);
+    mix(h, Ticks);
+
+    mix(h, (uint64_t)Shots.size());
+    for (size_t k = 0; k < Shots.size(); k++) {
+        const Shot& s = Shots.Active[k];
+        mix(h, s.OriginX); mix(h, s.OriginY);
+        mix(h, s.Vx); mix(h, s.Vy);
+        mix(h, s.t); mix(h, s.p); mix(h, s.q);
+        mix(h, s.Launched);
+        mix(h, s.Handle);
+        mix(h, s.Mirror);
+        mix(h, (int)s.Planned);
+    }
+    mix(h, (uint64_t)Scheduled.size());
+    for (size_t k = 0; k < Scheduled.size(); k++) {
+        mix(h, Scheduled[k].Tick);
+        mix(h, Scheduled[k].Brick);
+    }
+
+    mix(h, (uint64_t)Bricks.size());
+    mix(h, Bricks.NextId);
+    for (size_t i = 0; i < Bricks.size(); i++) {
+        mix(h, Bricks.X[i]); mix(h, Bricks.Y[i]);
+        mix(h, Bricks.Half[i]);
+        mix(h, Bricks.Phase[i]); mix(h, Bricks.Rate[i]);
+        mix(h, (int)Bricks.Alive[i]);
+        mix(h, Bricks.Id[i]);
+    }
+
+    mix(h, (uint64_t)Mirrors.size());
+    for (size_t m = 0; m < Mirrors.size(); m++) {
+        const Mirror& s = Mirrors.Segments[m];
+        mix(h, s.AX); mix(h, s.AY); mix(h, s.BX); mix(h, s.BY);
+    }
+    return h;
+}
+
+ShotPath World::shotPath (const Shot& shot) const
+{
+    double vx = shot.Vx/10, vy = shot.Vy/10;
+    double a = SHOT_TIME_RATE, t = shot.t;
+    ShotPath path = { { shot.OriginX + vx*t, vx*a },
+                      { shot.OriginY + vy*t - t*t/10, vy*a - 2*t*a/10, -a*a/10 } };
+    return path;
+}
+
+// The same path with s counted from by seconds earlier
+static ShotPath shifted (const ShotPath& path, double by)
+{
+    ShotPath moved = { { path.x[0] - path.x[1]*by, path.x[1] },
+                       { path.y[0] - path.y[1]*by + path.y[2]*by*by, path.y[1] - 2*path.y[2]*by, path.y[2] } };
+    return moved;
+}
+
+// Restarts the shot's arc from where path meets mirror m at s
+void World::bounce (Shot& shot, const ShotPath& path, int m, double s) const
+{
+    double vx = shot.Vx, vy = shot.Vy - 2*(shot.t + s*SHOT_TIME_RATE);
+    Mirrors.turn(m, vx, vy);
+    shot.OriginX = polyEval(path.x, 1, s);
+    shot.OriginY = polyEval(path.y, 2, s);
+    shot.Vx = vx;
+    shot.Vy = vy;
+    shot.t = shot.p = shot.q = 0;
+    shot.Mirror = m;
+}
+
+BrickFall World::brickFall (int i) const
+{
+    BrickFall fall = { Bricks.X[i], Bricks.Y[i], Bricks.Half[i] + BRICK_HIT_MARGIN,
+                       Bricks.Phase[i], Bricks.Rate[i] };
+    return fall;
+}
+
+BrickFall World::brickBefore (size_t i, double dt) const
+{
+    // One that wrapped is at the top and doesn't sweep across the jump
+    BrickFall fall = brickFall(i);
+    if (WrappedMask[i >> 6] >> (i & 63) & 1)
+        fall.rate = 0;
+    else
+        fall.phase -= fall.rate*dt;
+    return fall;
+}
+
+// Scores brick i; it stays in the table, dead, until the step compacts it
+void World::kill (size_t i)
+{
+    if (Bricks.Alive[i]) {
+        Bricks.Alive[i] = 0;
+        score++;
+    }
+}
+
+// Whether a shot's move took it into brick i
+bool World::touches (const ShotMove& move, size_t i, double dt) const
+{
+    BrickFall before = brickBefore(i, dt);
+    if (Collision == COLLIDE_SWEPT) {
+        BrickFall start = before, end = brickFall(i);
+        start.phase += before.rate*move.From;
+        if (move.To < dt) {
+            end = before;
+            end.phase += before.rate*move.To;
+        }
+        HitBox from = { start.cx, start.cy - start.phase*start.phase, start.half };
+        HitBox to = { end.cx, end.cy - end.phase*end.phase, end.half };
+        return sweptContact(move.x0, move.y0, move.x1, move.y1, SHOT_RADIUS, from, to) >= 0;
+    }
+    return advanceContact(move.Path, before, SHOT_RADIUS, move.From, move.To, ADVANCE_TOLERANCE) >= 0;
+}
+
+void World::step (double dt)
+{
+    beginStep();
+    Moves.clear();
+    moveShots(0, Shots.size(), dt, Moves, MirrorNear);
+    // With one shot moving without a bounce in a per-step mode, the fall
+    // picks out the bricks near it too
+    fallBricks(dt, Moves.size() == 1 ? &Moves[0] : NULL);
+    endStep(dt);
+}
+
+void World::beginStep ()
+{
+    Ticks++;
+    Mirrors.prepare();
+
+    // Shots that left the screen last step go back in the pool
+    for (size_t k = Shots.size(); k > 0; k--) {
+        const Shot& shot = Shots.Active[k - 1];
+        float z1 = shot.x(), z2 = shot.y();
+        if (z1 > 99.0 || z2 > 100.0 || z2 < -100.0)
+            Shots.retire(k - 1);
+    }
+}
+
+void World::moveShots (size_t begin, size_t end, double dt, std::vector<ShotMove>& moves,
+                       SpatialScratch& near)
+{
+    double frames = dt * WORLD_REFERENCE_HZ;
+    bool perStep = Collision != COLLIDE_PLANNED;
+    for (size_t k = begin; k < end; k++) {
+        Shot& shot = Shots.Active[k];
+        // Flight time left this step; each bounce starts the arc again
+        // from the mirror
+        double left = 0.08 * frames, from = 0;
+        for (int bounces = 0; ; bounces++) {
+            ShotMove move;
+            move.From = from;
+            move.x0 = shot.x();
+            move.y0 = shot.y();
+            ShotPath path = shotPath(shot);
+            double when;
+            int m = bounces < STEP_MAX_BOUNCES ? Mirrors.firstHit(path, 0, left / SHOT_TIME_RATE, shot.Mirror, when, near) : -1;
+            if (m >= 0) {
+                bounce(shot, path, m, when);
+                left -= when * SHOT_TIME_RATE;
+                move.To = from + when;
+            }
+            else {
+                shot.t += left;
+                shot.p = shot.Vx*shot.t;
+                shot.q = shot.Vy*shot.t - shot.t*shot.t;
+                move.To = dt;
+            }
+            move.x1 = shot.x();
+            move.y1 = shot.y();
+
+            if (perStep) {
+                move.Path = from > 0 ? shifted(path, from) : path;
+                double x0 = polyEval(move.Path.x, 1, from), y0 = polyEval(move.Path.y, 2, from);
+                move.MinX = fmin(fmin(move.x0, move.x1), x0);
+                move.MaxX = fmax(fmax(move.x0, move.x1), x0);
+                move.MinY = fmin(fmin(move.y0, move.y1), y0);
+                move.MaxY = fmax(fmax(move.y0, move.y1), y0);
+                double apex = -move.Path.y[1] / (2*move.Path.y[2]);
+                if (apex > move.From && apex < move.To)
+                    move.MaxY = fmax(move.MaxY, polyEval(move.Path.y, 2, apex));
+                moves.push_back(move);
+            }
+            if (m < 0)
+                break;
+            from = move.To;
+        }
+    }
+}
+
+void World::fallBricks (double dt, const ShotMove* query)
+{
+    // Fall, and for a query pick out the hit boxes near it: those within
+    // the shot radius of the circle around the box of everywhere it went
+    size_t count = Bricks.size();
+    BrickStep fall = { Bricks.X.data(), Bricks.Y.data(), Bricks.Half.data(),
+                       Bricks.Phase.data(), Bricks.Rate.data(), count, dt, BRICK_FALL_LIMIT,
+                       BRICK_HIT_MARGIN, 0, 0, -1, NULL, NULL };
+    Queried = query != NULL;
+    if (query) {
+        fall.QueryX = (query->MinX + query->MaxX) / 2;
+        fall.QueryY = (query->MinY + query->MaxY) / 2;
+        fall.Reach = detHypot(query->MaxX - query->MinX, query->MaxY - query->MinY) / 2 + SHOT_RADIUS;
+    }
+    size_t words = (count + 63) / 64;
+    WrappedMask.resize(words);
+    HitMask.resize(words);
+    fall.Wrapped = WrappedMask.data();
+    fall.Hits = HitMask.data();
+    stepBricks(fall);
+}
+
+void World::endStep (double dt)
+{
+    size_t count = Bricks.size();
+    bool perStep = Collision != COLLIDE_PLANNED;
+    // A lone move the fall didn't test the bricks against is checked like
+    // many; both broad phases keep every brick it could touch
+    bool single = Queried && Moves.size() == 1;
+
+    if (!perStep) {
+        if (dt != PlanDt)
+            Replan = true;
+        if (Replan) {
+            Replan = false;
+            PlanDt = dt;
+            Scheduled.clear();
+            for (size_t k = 0; k < Shots.size(); k++)
+                Shots.Active[k].Planned = false;
+        }
+        for (size_t k = 0; k < Shots.size(); k++)
+            if (!Shots.Active[k].Planned)
+                planShot(Shots.Active[k], dt);
+
+        // No checks here: hits were scheduled when each path was planned
+        while (!Scheduled.empty() && Scheduled.front().Tick <= Ticks) {
+            int i = Bricks.row(Scheduled.front().Brick);
+            if (i >= 0)
+                kill(i);
+            std::pop_heap(Scheduled.begin(), Scheduled.end(), later);
+            Scheduled.pop_back();
+        }
+    }
+    else if (single) {
+        Candidates.resize(count);
+        size_t near = maskIndices(HitMask.data(), count, Candidates.data());
+        for (size_t k = 0; k < near; k++)
+            if (touches(Moves[0], Candidates[k], dt))
+                kill(Candidates[k]);
+    }
+    else if (Moves.size() > 0) {
+        // Each brick's box over the step, grown to its hit box and by the shot radius
+        float grow = BRICK_HIT_MARGIN + SHOT_RADIUS;
+        bool grid = count >= GRID_MIN_BRICKS;
+        if (grid) {
+            Grid.clear();
+            for (size_t i = 0; i < count; i++) {
+                BrickFall before = brickBefore(i, dt);
+                float h = Bricks.Half[i] + grow;
+                float top = before.cy - before.phase*before.phase, bottom = Bricks.y(i);
+                Grid.insert((int)i, Bricks.X[i] - h, bottom - h, Bricks.X[i] + h, top + h);
+            }
+            Grid.build();
+        }
+        for (size_t k = 0; k < Moves.size(); k++) {
+            const ShotMove& move = Moves[k];
+            Near.clear();
+            if (grid)
+                Grid.query(move.MinX, move.MinY, move.MaxX, move.MaxY, Near);
+            else
+                for (size_t i = 0; i < count; i++) {
+                    BrickFall before = brickBefore(i, dt);
+                    float h = Bricks.Half[i] + grow;
+                    float top = before.cy - before.phase*before.phase, bottom = Bricks.y(i);
+                    if (Bricks.X[i] + h >= move.MinX && Bricks.X[i] - h <= move.MaxX &&
+                        top + h >= move.MinY && bottom - h <= move.MaxY)
+                        Near.push_back((int)i);
+                }
+            for (size_t n = 0; n < Near.size(); n++)
+                if (Bricks.Alive[Near[n]] && touches(move, Near[n], dt))
+                    kill(Near[n]);
+        }
+    }
+
+    Bricks.compact();
+    Won = allHit() && Shots.size() == 0;
+}
+
+/* Works out from the state just stepped to (s = 0) which tick, if any, the
+   shot first touches each brick, assuming fixed steps of dt and no further
+   input, and schedules those hits. With s in seconds the shot is
+
+       x = x0 + vx T/10,  y = y0 + (vy T - T^2)/10,  T = t + 4.8s
+
+   from wherever it was fired or last bounced, and a brick's centre drops by
+   phase^2, phase rising linearly between wraps, so contact is where
+   polynomials in s change sign (see planContact). It lands on the first
+   tick at or after that moment, so hits fall out exactly however far the
+   pair moves per tick. Bounces split the flight into arcs planned in turn. */
+void World::planShot (Shot& shot, double dt)
+{
+    shot.Planned = true;
+    ShotPath path = shotPath(shot);
+    Aimed.assign(Bricks.size(), 0);
+
+    double start = 0;
+    int mirror = shot.Mirror;
+    for (int bounces = 0; bounces <= PLAN_MAX_BOUNCES; bounces++) {
+        // The shot is live until it leaves the bounds step() checks
+        double exit = PLAN_HORIZON;
+        double right[2] = { 99 - path.x[0], -path.x[1] };
+        double top[3] = { 100 - path.y[0], -path.y[1], -path.y[2] };
+        double bottom[3] = { path.y[0] + 100, path.y[1], path.y[2] };
+        double s;
+        if ((s = polyFirstContact(right, 1, start, exit)) >= 0) exit = s;
+        if ((s = polyFirstContact(top, 2, start, exit)) >= 0) exit = s;
+        if ((s = polyFirstContact(bottom, 2, start, exit)) >= 0) exit = s;
+        // The step that carries it out still runs in full
+        exit = fmin(ceil(exit/dt - 1e-9) * dt, PLAN_HORIZON);
+
+        double when;
+        int m = bounces < PLAN_MAX_BOUNCES ? Mirrors.firstHit(path, start, exit, mirror, when) : -1;
+        planArc(path, start, m >= 0 ? when : exit, dt);
+        if (m < 0)
+            break;
+        path = Mirrors.reflect(path, m, when);
+        start = when;
+        mirror = m;
+    }
+}
+
+// Schedules the first hit on each brick not yet aimed at, for a shot on
+// path from start to end
+void World::planArc (const ShotPath& path, double start, double end, double dt)
+{
+    double limit = sqrt(BRICK_FALL_LIMIT);
+    for (size_t i = 0; i < Bricks.size(); i++) {
+        if (Aimed[i])
+            continue;
+        BrickFall fall = brickFall(i);
+
+        // The shot can touch this brick only while it is in line with it;
+        // most of the field is passed over here
+        double reach = fall.half + SHOT_RADIUS, enter = start, leave = end;
+        if (path.x[1] != 0) {
+            double a = (fall.cx - reach - path.x[0]) / path.x[1];
+            double b = (fall.cx + reach - path.x[0]) / path.x[1];
+            enter = fmax(enter, fmin(a, b));
+            leave = fmin(leave, fmax(a, b));
+        }
+        else if (fabs(path.x[0] - fall.cx) > reach)
+            continue;
+
+        double rate = fall.rate, phase = fall.phase, lo = 0;
+        long ticks = 0;          // ticks from now to the start of this fall
+        while (lo <= leave) {
+            // The brick wraps to the top on the first tick its phase reaches the limit
+            long wrap = rate > 0 ? (long)ceil((limit - phase) / (rate*dt)) : 0;
+            if (wrap < 1)
+                wrap = rate > 0 ? 1 : (long)(PLAN_HORIZON / dt) + 1;
+            // It is last seen falling the tick before; it never goes past there
+            double hi = fmin(end, (ticks + wrap - 1) * dt);
+
+            fall.phase = phase - rate*lo;      // phase at s = 0 on this fall
+
+            // While level with the brick, the shot must also reach the
+            // heights the brick falls through
+            double from = fmax(lo, enter), to = fmin(hi, leave);
+            double contact = -1;
+            if (from <= to) {
+                double y0 = polyEval(path.y, 2, from), y1 = polyEval(path.y, 2, to);
+                double low = fmin(y0, y1), high = fmax(y0, y1);
+                double apex = -path.y[1] / (2*path.y[2]);
+                if (apex > from && apex < to)
+                    high = fmax(high, polyEval(path.y, 2, apex));
+                double p0 = fall.phase + rate*from, p1 = fall.phase + rate*to;
+                if (high >= fall.cy - p1*p1 - reach && low <= fall.cy - p0*p0 + reach)
+                    contact = planContact(path, fall, SHOT_RADIUS, fmax(lo, start), hi);
+            }
+            if (contact >= 0) {
+                HitEvent hit = { Ticks + (long)ceil(contact/dt - 1e-9), Bricks.Id[i] };
+                Scheduled.push_back(hit);
+                std::push_heap(Scheduled.begin(), Scheduled.end(), later);
+                Aimed[i] = 1;
+                break;
+            }
+            lo = (ticks + wrap) * dt;
+            ticks += wrap;
+            phase = 0;
+        }
+    }
+}
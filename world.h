@@ -0,0 +1,120 @@
+#ifndef WORLD_H
+#define WORLD_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "bricks.h"
+#include "collide.h"
+#include "mirrors.h"
+#include "shots.h"
+#include "spatial.h"
+
+/* The game simulation - baskets, cannon, shots, bricks and scoring - with no
+   GL or GLFW dependency. Sample_GL3_2D.cpp renders a World and turns key
+   events into WorldInputs; headless runs drive it directly. */
+
+// Rates are per second. At this many steps a second one step matches one
+// frame of the original per-frame update.
+const double WORLD_REFERENCE_HZ = 60;
+
+// Bricks in the level reset() sets up; addBrick() takes any number more
+const int WORLD_BRICKS = 3;
+
+// A shot's flight over one step, or the part of it between two bounces,
+// for the per-step collision modes
+struct ShotMove {
+    double From, To;          // seconds into the step
+    float x0, y0, x1, y1;     // at From and To
+    ShotPath Path;            // s in seconds from the start of the step
+    double MinX, MinY, MaxX, MaxY;  // everywhere it went, the top of its arc included
+};
+
+enum WorldAction {
+    AIM_UP,
+    AIM_DOWN,
+    BASKET1_LEFT,             // basket x (right ctrl)
+    BASKET1_RIGHT,
+    BASKET2_LEFT,             // basket X (right alt)
+    BASKET2_RIGHT,
+    FIRE
+};
+
+struct WorldInput {
+    WorldAction Action;
+    double Charge;            // FIRE only: seconds the fire key was held
+};
+
+// A brick COLLIDE_PLANNED has scheduled a shot to hit, see planShot()
+struct HitEvent {
+    long Tick;
+    int Brick;                // Id, which outlives its row in the table
+};
+
+struct World {
+    float x, y;               // basket moved with right ctrl
+    float X, Y;               // basket moved with right alt
+    float rot_ang;            // cannon angle in degrees, -50..50
+    ShotPool Shots;           // every shot in flight
+    MirrorSet Mirrors;
+    BrickTable Bricks;        // only bricks still standing, in no order
+    CollisionMode Collision;  // kept across reset()
+    // COLLIDE_PLANNED schedules each shot's hits once, the step after it is
+    // fired, as a min-heap on Tick
+    std::vector<HitEvent> Scheduled;
+    std::vector<unsigned char> Aimed;   // planShot scratch: brick already scheduled
+    bool Replan;              // a path or the bricks changed: plan every shot again
+    double PlanDt;            // step the plans were made for
+    int score;
+    bool Won;                 // every brick gone and no shot left in flight
+    long Ticks;
+
+    // Scratch for step(), kept so steps don't allocate. Bit i is brick i.
+    std::vector<uint64_t> WrappedMask;  // went back to the top this step
+    std::vector<uint64_t> HitMask;      // near enough the shot to test properly
+    std::vector<unsigned> Candidates;
+    std::vector<ShotMove> Moves;        // each shot's, one more per bounce
+    bool Queried;                       // fallBricks() set HitMask for Moves[0]
+    SpatialScratch MirrorNear;          // step()'s for moveShots()
+    std::vector<int> Near;
+    SpatialHash Grid;                   // over the bricks when many shots are out
+
+    // Room for shotCapacity shots in flight is taken up front; the scheduled
+    // hits and the scratch grow as play needs them, and keep what they grew to
+    explicit World (size_t shotCapacity = SHOT_CAPACITY);
+    // Copies keep the room too, so a copy doesn't allocate where the world
+    // it came from no longer does
+    World (const World& other);
+    World& operator= (const World& other);
+
+    void reset ();
+    void addBrick (float originX, float originY, double rate);
+    void addMirror (double ax, double ay, double bx, double by);
+    void apply (const WorldInput& input);
+    void step (double dt);
+    // step() in phases, to spread one over threads: beginStep(), then
+    // moveShots() over any split of the shots alongside fallBricks(), each
+    // writing only its own shots, moves and near scratch or the bricks, then
+    // endStep() once the moves are in Moves in shot order. query, if not
+    // NULL, is the only move of the step, for the fall to pick out the
+    // bricks near it.
+    void beginStep ();
+    void moveShots (size_t begin, size_t end, double dt, std::vector<ShotMove>& moves,
+                    SpatialScratch& near);
+    void fallBricks (double dt, const ShotMove* query);
+    void endStep (double dt);
+    void planShot (Shot& shot, double dt);
+    void planArc (const ShotPath& path, double start, double end, double dt);
+    void bounce (Shot& shot, const ShotPath& path, int mirror, double s) const;
+    void kill (size_t i);
+
+    ShotPath shotPath (const Shot& shot) const;   // where it goes from now on
+    BrickFall brickFall (int i) const;  // hit box of brick i from now until it wraps
+    BrickFall brickBefore (size_t i, double dt) const;  // brick i as it was a step ago
+    bool allHit () const;
+    // Of every bit of state a step reads; equal hashes mean runs went the same
+    uint64_t hash () const;
+    bool touches (const ShotMove& move, size_t i, double dt) const;
+};
+
+#endif